@@ -0,0 +1,66 @@
+#!/bin/sh
+
+# Compare binary size and resident memory of the lean build (make lean) with
+# the default build and check them against the budget. Resident memory is
+# measured while the daemon runs, after it has polled the given device (or
+# SANE_DEFAULT_DEVICE or the first device found) once.
+
+if [ $# -lt 4 ] || [ $# -gt 5 ]; then
+    echo "USAGE: $0 <default binary> <lean binary> <size budget kB> <resident memory budget kB> [device]"
+    exit 1
+fi
+DEVICE=$5
+
+# text, data and bss in kB, regardless of symbols
+size_kb() {
+    size "$1" | awk 'NR == 2 { print int(($1 + $2 + $3 + 1023) / 1024) }'
+}
+
+# resident memory of the running daemon after its first poll, without event handlers
+rss_kb() {
+    dir=$(mktemp -d) || return
+    mkdir "$dir/events"
+    if [ -n "$DEVICE" ]; then
+        "$1" -n -vv -e "$dir/events" -d "$DEVICE" >"$dir/log" 2>&1 &
+    else
+        "$1" -n -vv -e "$dir/events" >"$dir/log" 2>&1 &
+    fi
+    pid=$!
+    tries=0
+    while [ $tries -lt 300 ] && kill -0 $pid 2>/dev/null && ! grep -q "fetch all sensor values" "$dir/log"; do
+        sleep 0.1
+        tries=$((tries + 1))
+    done
+    if grep -q "fetch all sensor values" "$dir/log"; then
+        sed -n 's/^VmRSS:[^0-9]*\([0-9]*\) kB/\1/p' /proc/$pid/status
+    else
+        echo "$1 did not poll the device, see $dir/log" >&2
+    fi
+    kill -INT $pid 2>/dev/null
+    wait $pid
+    grep -q "fetch all sensor values" "$dir/log" && rm -r "$dir"
+}
+
+DEFAULT_SIZE=$(size_kb "$1")
+LEAN_SIZE=$(size_kb "$2")
+DEFAULT_RSS=$(rss_kb "$1")
+LEAN_RSS=$(rss_kb "$2")
+if [ -z "$DEFAULT_SIZE" ] || [ -z "$LEAN_SIZE" ] || [ -z "$DEFAULT_RSS" ] || [ -z "$LEAN_RSS" ]; then
+    echo "Could not measure $1 and $2"
+    exit 1
+fi
+
+printf "%-24s %8s %8s %8s\n" "" default lean budget
+printf "%-24s %8s %8s %8s\n" "binary size (kB)" "$DEFAULT_SIZE" "$LEAN_SIZE" "$3"
+printf "%-24s %8s %8s %8s\n" "resident memory (kB)" "$DEFAULT_RSS" "$LEAN_RSS" "$4"
+
+STATUS=0
+if [ "$LEAN_SIZE" -gt "$3" ] || [ "$LEAN_SIZE" -gt "$DEFAULT_SIZE" ]; then
+    echo "Binary size of the lean build is over budget"
+    STATUS=1
+fi
+if [ "$LEAN_RSS" -gt "$4" ] || [ "$LEAN_RSS" -gt "$DEFAULT_RSS" ]; then
+    echo "Resident memory of the lean build is over budget"
+    STATUS=1
+fi
+exit $STATUS
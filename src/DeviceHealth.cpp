@@ -0,0 +1,127 @@
+
+#include "DeviceHealth.h"
+
+#include <algorithm>
+#include <unistd.h>
+
+#include "Timer.h"
+
+
+const int DeviceHealth::MAX_BACKOFF_MS = 60000;
+const int DeviceHealth::DEGRADED_RETRIES = 3;
+const int DeviceHealth::JITTER_PERCENT = 20;
+
+
+DeviceHealth::DeviceHealth(int period_ms)
+    : mPeriodMs(period_ms),
+      mStateSinceUs(Timer::monotonic_us()),
+      mRandom(static_cast<std::minstd_rand::result_type>(mStateSinceUs ^ getpid()))
+{
+}
+
+
+void DeviceHealth::set_period(int period_ms) noexcept
+{
+    mPeriodMs = period_ms;
+}
+
+
+bool DeviceHealth::may_poll(long long now_us) const noexcept
+{
+    return now_us >= mNextPollUs;
+}
+
+
+long long DeviceHealth::next_poll_ms(long long now_us) const noexcept
+{
+    return std::max(static_cast<long long>(mPeriodMs), (mNextPollUs - now_us + 999) / 1000);
+}
+
+
+bool DeviceHealth::success(long long now_us) noexcept
+{
+    mFailures = 0;
+    mNextPollUs = 0;
+    return enter(HEALTHY, now_us);
+}
+
+
+bool DeviceHealth::failure(SANE_Status status, bool open_failed, long long now_us) noexcept
+{
+    if (status == SANE_STATUS_DEVICE_BUSY) {
+        // someone else uses the device, this is handled by suspending the main loop
+        return false;
+    }
+    mFailures++;
+
+    State state = DEGRADED;
+    if (open_failed) {
+        // backends report unknown or unplugged devices as invalid argument
+        state = status == SANE_STATUS_INVAL ? ABSENT : OPEN_FAILED;
+    }
+
+    long long delay_ms = mPeriodMs;
+    int backoff = state == DEGRADED ? mFailures - DEGRADED_RETRIES : mFailures - 1;
+    if (backoff > 0) {
+        delay_ms = static_cast<long long>(mPeriodMs) << std::min(backoff, 20);
+        delay_ms = std::min(delay_ms, static_cast<long long>(MAX_BACKOFF_MS));
+        // spread the attempts, so that several daemons do not hit the bus at the same time
+        long long jitter = delay_ms * JITTER_PERCENT / 100;
+        if (jitter > 0) {
+            delay_ms += static_cast<long long>(mRandom() % (2 * jitter + 1)) - jitter;
+        }
+    }
+    mNextPollUs = now_us + delay_ms * 1000;
+    return enter(state, now_us);
+}
+
+
+DeviceHealth::State DeviceHealth::state() const noexcept
+{
+    return mState;
+}
+
+
+int DeviceHealth::failures() const noexcept
+{
+    return mFailures;
+}
+
+
+long long DeviceHealth::time_in_state_ms(State state, long long now_us) const noexcept
+{
+    long long time_us = mStateTimeUs[state];
+    if (state == mState) {
+        time_us += now_us - mStateSinceUs;
+    }
+    return time_us / 1000;
+}
+
+
+const char * DeviceHealth::state_name(State state) noexcept
+{
+    switch (state) {
+    case HEALTHY:
+        return "healthy";
+    case DEGRADED:
+        return "degraded";
+    case OPEN_FAILED:
+        return "open-failed";
+    case ABSENT:
+        return "absent";
+    default:
+        return "unknown";
+    }
+}
+
+
+bool DeviceHealth::enter(State state, long long now_us) noexcept
+{
+    if (state == mState) {
+        return false;
+    }
+    mStateTimeUs[mState] += now_us - mStateSinceUs;
+    mStateSinceUs = now_us;
+    mState = state;
+    return true;
+}
@@ -0,0 +1,156 @@
+/*
+ *  DeviceHealth.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+#ifndef DEVICEHEALTH_H
+#define DEVICEHEALTH_H
+
+#include <random>
+
+#include <sane/sane.h>
+
+
+/** Circuit breaker for a polled device.
+ *
+ * Tracks consecutive poll failures and delays further attempts with an
+ * exponential backoff, so an absent or broken device is not reopened
+ * (and the bus rescanned) every polling period. The first successful poll
+ * restores the normal polling rate.
+ */
+class DeviceHealth
+{
+public:
+    /// Health states
+    enum State : int {
+        /// Last poll was successful
+        HEALTHY = 0,
+        /// Device could be opened, but reading sensors failed
+        DEGRADED,
+        /// Device is present, but could not be opened
+        OPEN_FAILED,
+        /// Device could not be found
+        ABSENT,
+        /// Number of states
+        STATE_COUNT
+    };
+
+    /** Constructor
+     * @param period_ms normal polling period
+     */
+    DeviceHealth(int period_ms);
+
+    /**
+     * Change normal polling period
+     * @param period_ms
+     */
+    void set_period(int period_ms) noexcept;
+
+    /**
+     * @param now_us current monotonic time
+     * @return true iff the device should be polled now
+     */
+    bool may_poll(long long now_us) const noexcept;
+
+    /**
+     * @param now_us current monotonic time
+     * @return time in ms until the device should be polled next time, at least the polling period
+     */
+    long long next_poll_ms(long long now_us) const noexcept;
+
+    /**
+     * Record successful poll
+     * @param now_us current monotonic time
+     * @return true iff the state has changed
+     */
+    bool success(long long now_us) noexcept;
+
+    /**
+     * Record failed poll
+     * @param status SANE status of the failed operation
+     * @param open_failed true iff the device could not be opened
+     * @param now_us current monotonic time
+     * @return true iff the state has changed
+     */
+    bool failure(SANE_Status status, bool open_failed, long long now_us) noexcept;
+
+    /**
+     * @return current state
+     */
+    State state() const noexcept;
+
+    /**
+     * @return number of consecutive failures
+     */
+    int failures() const noexcept;
+
+    /**
+     * @param state
+     * @param now_us current monotonic time
+     * @return total time in ms spent in the given state
+     */
+    long long time_in_state_ms(State state, long long now_us) const noexcept;
+
+    /**
+     * @param state
+     * @return human readable state name
+     */
+    static const char * state_name(State state) noexcept;
+
+private:
+    /// Longest delay between attempts in ms
+    static const int MAX_BACKOFF_MS;
+
+    /// Number of failures in degraded state before backing off
+    static const int DEGRADED_RETRIES;
+
+    /// Maximal relative random deviation of the delay in percent
+    static const int JITTER_PERCENT;
+
+    /// Normal polling period in ms
+    int mPeriodMs;
+
+    /// Current state
+    State mState = HEALTHY;
+
+    /// Number of consecutive failures
+    int mFailures = 0;
+
+    /// Time the current state was entered
+    long long mStateSinceUs;
+
+    /// Time of the next poll attempt
+    long long mNextPollUs = 0;
+
+    /// Time spent in each state, excluding the current period
+    long long mStateTimeUs[STATE_COUNT] = {};
+
+    /// Random source for the jitter
+    std::minstd_rand mRandom;
+
+    /**
+     * Switch to given state
+     * @param state
+     * @param now_us
+     * @return true iff the state has changed
+     */
+    bool enter(State state, long long now_us) noexcept;
+};
+
+#endif
@@ -0,0 +1,315 @@
+
+#include "EventJournal.h"
+#include "InsaneException.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "Timer.h"
+
+
+namespace {
+
+/// Identifies journal files
+const char JOURNAL_MAGIC[8] = {'I', 'N', 'S', 'J', 'R', 'N', 'L', '1'};
+
+/// Format version, increment on incompatible changes
+const uint32_t JOURNAL_VERSION = 1;
+
+
+/**
+ * Copy string into fixed size buffer, truncating and zero-padding it
+ */
+template <size_t N>
+void copy_name(char (&dest)[N], const std::string & src) noexcept
+{
+    size_t n = std::min(src.size(), N - 1);
+    memcpy(dest, src.data(), n);
+    memset(dest + n, 0, N - n);
+}
+
+
+/**
+ * @return wall clock time in us since epoch
+ */
+int64_t realtime_us() noexcept
+{
+    timeval now;
+    gettimeofday(&now, nullptr);
+    return static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_usec;
+}
+
+}
+
+
+struct EventJournal::Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+    uint32_t reserved;
+    /// Sequence number of the next record
+    uint64_t next_seq;
+    char padding[96];
+};
+
+static_assert(sizeof(EventJournal::Record) == 128, "journal records must be 128 bytes");
+
+const uint32_t EventJournal::DEFAULT_CAPACITY = 4096;
+
+
+EventJournal::EventJournal()
+{
+    static_assert(sizeof(Header) == 128, "journal header must be 128 bytes");
+}
+
+
+EventJournal::~EventJournal() noexcept
+{
+    close();
+}
+
+
+void EventJournal::open(const std::string & path, bool writable)
+{
+    close();
+    int fd = ::open(path.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        throw InsaneException("Could not open journal '" + path + "': " + strerror(errno));
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        ::close(fd);
+        throw InsaneException("Could not stat journal '" + path + "': " + strerror(errno));
+    }
+
+    // check existing header
+    Header existing;
+    memset(&existing, 0, sizeof(existing));
+    ssize_t got = pread(fd, &existing, sizeof(existing), 0);
+    bool journal = got >= static_cast<ssize_t>(sizeof(JOURNAL_MAGIC))
+        && memcmp(existing.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) == 0;
+    bool valid = journal
+        && got == static_cast<ssize_t>(sizeof(existing))
+        && existing.version == JOURNAL_VERSION
+        && existing.record_size == sizeof(Record)
+        && existing.capacity > 0
+        && static_cast<size_t>(st.st_size) >= sizeof(Header) + existing.capacity * sizeof(Record);
+
+    // only an empty file or a journal of another version or size is started over, never a file of someone else
+    if (!valid && (!writable || (st.st_size > 0 && !journal))) {
+        ::close(fd);
+        throw InsaneException("'" + path + "' is not an insaned journal");
+    }
+    uint32_t capacity = valid ? existing.capacity : DEFAULT_CAPACITY;
+    size_t size = sizeof(Header) + capacity * sizeof(Record);
+    if (!valid) {
+        // start a new journal
+        if (ftruncate(fd, 0) < 0 || ftruncate(fd, static_cast<off_t>(size)) < 0) {
+            ::close(fd);
+            throw InsaneException("Could not resize journal '" + path + "': " + strerror(errno));
+        }
+    }
+
+    void * map = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        throw InsaneException("Could not map journal '" + path + "': " + strerror(errno));
+    }
+    mMap = map;
+    mSize = size;
+
+    if (!valid) {
+        Header * h = header();
+        memcpy(h->magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        h->version = JOURNAL_VERSION;
+        h->record_size = sizeof(Record);
+        h->capacity = capacity;
+        h->next_seq = 1;
+    } else if (writable) {
+        // the daemon may have died between writing a record and updating the header
+        uint64_t next = std::max<uint64_t>(header()->next_seq, 1);
+        for (uint32_t i = 0; i < capacity; ++i) {
+            next = std::max(next, reinterpret_cast<Record *>(header() + 1)[i].seq + 1);
+        }
+        __atomic_store_n(&header()->next_seq, next, __ATOMIC_RELEASE);
+    }
+}
+
+
+void EventJournal::close() noexcept
+{
+    if (mMap) {
+        munmap(mMap, mSize);
+        mMap = nullptr;
+        mSize = 0;
+    }
+}
+
+
+bool EventJournal::is_open() const noexcept
+{
+    return mMap != nullptr;
+}
+
+
+void EventJournal::append(Type type, const std::string & device, const std::string & event, int status, int pid, int64_t duration_us) noexcept
+{
+    if (!mMap) {
+        return;
+    }
+    uint64_t seq = __atomic_load_n(&header()->next_seq, __ATOMIC_RELAXED);
+    Record record;
+    record.seq = seq;
+    record.realtime_us = realtime_us();
+    record.monotonic_us = Timer::monotonic_us();
+    record.duration_us = duration_us;
+    record.type = type;
+    record.status = status;
+    record.pid = pid;
+    record.reserved = 0;
+    copy_name(record.device, device);
+    copy_name(record.event, event);
+
+    // invalidate the slot, copy the record, then publish its sequence number;
+    // the fence keeps the copy from being reordered before the invalidation
+    Record * dest = slot(seq);
+    __atomic_store_n(&dest->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(reinterpret_cast<char *>(dest) + sizeof(record.seq), reinterpret_cast<const char *>(&record) + sizeof(record.seq),
+           sizeof(Record) - sizeof(record.seq));
+    __atomic_store_n(&dest->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&header()->next_seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+
+std::vector<EventJournal::Record> EventJournal::records() const
+{
+    std::vector<Record> result;
+    if (!mMap) {
+        return result;
+    }
+    uint64_t next = __atomic_load_n(&header()->next_seq, __ATOMIC_ACQUIRE);
+    uint64_t capacity = __atomic_load_n(&header()->capacity, __ATOMIC_RELAXED);
+    uint64_t first = next > capacity ? next - capacity : 1;
+    for (uint64_t seq = first; seq < next; ++seq) {
+        const Record * src = slot(seq);
+        Record record;
+        // seqlock read: the payload is copied between two loads of the sequence number,
+        // the fence keeps the copy from being reordered after the second load
+        uint64_t before = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+        memcpy(reinterpret_cast<char *>(&record) + sizeof(record.seq), reinterpret_cast<const char *>(src) + sizeof(record.seq),
+               sizeof(Record) - sizeof(record.seq));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        record.seq = __atomic_load_n(&src->seq, __ATOMIC_RELAXED);
+        // skip records that are being overwritten
+        if (before == seq && record.seq == seq) {
+            record.device[sizeof(record.device) - 1] = '\0';
+            record.event[sizeof(record.event) - 1] = '\0';
+            result.push_back(record);
+        }
+    }
+    return result;
+}
+
+
+void EventJournal::print(std::ostream & out) const
+{
+    struct Summary {
+        long dispatched = 0;
+        long no_handler = 0;
+        long failed = 0;
+        int64_t latency_us = 0;
+        int64_t runtime_us = 0;
+        long exits = 0;
+    };
+    std::map<std::string, Summary> summary;
+
+    auto records = this->records();
+    out << std::fixed << std::setprecision(1);
+    for (auto & record : records) {
+        time_t seconds = static_cast<time_t>(record.realtime_us / 1000000);
+        tm local;
+        localtime_r(&seconds, &local);
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &local);
+        out << when << "." << std::setw(3) << std::setfill('0') << (record.realtime_us / 1000) % 1000 << std::setfill(' ')
+            << "  " << record.device << "  " << record.event << "  ";
+
+        std::string key = std::string(record.device) + " " + record.event;
+        Summary & s = summary[key];
+        switch (record.type) {
+        case DISPATCHED:
+            s.dispatched++;
+            s.latency_us += record.duration_us;
+            out << "dispatched, pid " << record.pid << ", " << record.duration_us / 1000.0 << " ms after sample";
+            break;
+        case NO_HANDLER:
+            s.no_handler++;
+            if (record.status == 0) {
+                out << "handler is empty";
+            } else {
+                out << "no handler: " << strerror(record.status);
+            }
+            break;
+        case HANDLER_EXIT:
+            s.exits++;
+            s.runtime_us += record.duration_us;
+            if (WIFEXITED(record.status)) {
+                out << "handler exited with status " << WEXITSTATUS(record.status);
+                if (WEXITSTATUS(record.status) != 0) {
+                    s.failed++;
+                }
+            } else if (WIFSIGNALED(record.status)) {
+                out << "handler killed by signal " << WTERMSIG(record.status);
+                s.failed++;
+            } else {
+                out << "handler status " << record.status;
+            }
+            out << " after " << record.duration_us / 1000.0 << " ms";
+            break;
+        default:
+            out << "unknown record type " << record.type;
+            break;
+        }
+        out << std::endl;
+    }
+
+    out << "Summary of " << records.size() << " records:" << std::endl;
+    for (auto & entry : summary) {
+        const Summary & s = entry.second;
+        out << "    " << entry.first << ": " << s.dispatched << " dispatched";
+        if (s.dispatched > 0) {
+            out << " (avg " << s.latency_us / s.dispatched / 1000.0 << " ms after sample)";
+        }
+        out << ", " << s.no_handler << " without handler, " << s.failed << " failed handlers";
+        if (s.exits > 0) {
+            out << ", avg handler run time " << s.runtime_us / s.exits / 1000.0 << " ms";
+        }
+        out << std::endl;
+    }
+}
+
+
+EventJournal::Header * EventJournal::header() const noexcept
+{
+    return static_cast<Header *>(mMap);
+}
+
+
+EventJournal::Record * EventJournal::slot(uint64_t seq) const noexcept
+{
+    return reinterpret_cast<Record *>(header() + 1) + (seq % header()->capacity);
+}
@@ -0,0 +1,143 @@
+/*
+ *  EventJournal.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+#ifndef EVENTJOURNAL_H
+#define EVENTJOURNAL_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+/** Fixed-size ring of binary event records in a memory-mapped file.
+ *
+ * Records are written directly into the shared mapping, so they survive a
+ * crash of the daemon and can be read while it is running. A record is
+ * only valid if its sequence number is the same before and after copying
+ * it, which lets readers skip a record that is being overwritten.
+ */
+class EventJournal
+{
+public:
+    /// Record types
+    enum Type : uint32_t {
+        /// Event passed debouncing and its handler was started
+        DISPATCHED = 1,
+        /// Event passed debouncing, but there is no usable handler
+        NO_HANDLER = 2,
+        /// Handler exited
+        HANDLER_EXIT = 3
+    };
+
+    /// Single journal entry, exactly 128 bytes
+    struct Record {
+        /// Sequence number, starts at 1, 0 for unused or incomplete slots
+        uint64_t seq;
+        /// Wall clock time in us since epoch
+        int64_t realtime_us;
+        /// Monotonic time in us
+        int64_t monotonic_us;
+        /// DISPATCHED: time since the sample was taken, HANDLER_EXIT: run time of the handler
+        int64_t duration_us;
+        /// One of Type
+        uint32_t type;
+        /// HANDLER_EXIT: wait status of the handler, NO_HANDLER: errno
+        int32_t status;
+        /// Handler process
+        int32_t pid;
+        uint32_t reserved;
+        /// Device name, truncated
+        char device[48];
+        /// Event name, truncated
+        char event[32];
+    };
+
+    /// Number of records in a new journal
+    static const uint32_t DEFAULT_CAPACITY;
+
+    /** Constructor
+     */
+    EventJournal();
+
+    /** Destructor, unmaps the journal
+     */
+    ~EventJournal() noexcept;
+
+    /**
+     * Map given journal file, creating it if needed
+     * @param path
+     * @param writable false to open an existing journal read only
+     */
+    void open(const std::string & path, bool writable);
+
+    /**
+     * Unmap the journal
+     */
+    void close() noexcept;
+
+    /**
+     * @return true iff a journal is mapped
+     */
+    bool is_open() const noexcept;
+
+    /**
+     * Append a record, overwriting the oldest one if the journal is full
+     * @param type
+     * @param device
+     * @param event
+     * @param status
+     * @param pid
+     * @param duration_us
+     */
+    void append(Type type, const std::string & device, const std::string & event, int status, int pid, int64_t duration_us) noexcept;
+
+    /**
+     * @return snapshot of all valid records, oldest first
+     */
+    std::vector<Record> records() const;
+
+    /**
+     * Print all records followed by a summary
+     * @param out
+     */
+    void print(std::ostream & out) const;
+
+private:
+    /// File header
+    struct Header;
+
+    /// Mapped file
+    void * mMap = nullptr;
+
+    /// Size of the mapping
+    size_t mSize = 0;
+
+    // Forbid copy
+    EventJournal(const EventJournal &);
+    EventJournal & operator=(const EventJournal &);
+
+    Header * header() const noexcept;
+
+    Record * slot(uint64_t seq) const noexcept;
+};
+
+#endif
@@ -0,0 +1,284 @@
+
+#include "EventServer.h"
+#include "InsaneException.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+
+namespace {
+
+/// Longest accepted filter line
+const size_t MAX_LINE = 256;
+
+
+/**
+ * Make socket non-blocking and not inherited by event handler scripts
+ */
+void setup_fd(int fd) noexcept
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+}
+
+
+const size_t EventServer::MAX_BUFFER = 16384;
+const size_t EventServer::MAX_CLIENTS = 64;
+
+
+EventServer::EventServer()
+{
+}
+
+
+EventServer::~EventServer() noexcept
+{
+    close();
+}
+
+
+void EventServer::open(const std::string & path)
+{
+    close();
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw InsaneException("Event socket path '" + path + "' is too long");
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    // remove a socket left behind by a crashed daemon, but nothing else
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path.c_str());
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw InsaneException(std::string("Could not create event socket: ") + strerror(errno));
+    }
+    setup_fd(fd);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        std::string err = strerror(errno);
+        ::close(fd);
+        throw InsaneException("Could not listen on event socket '" + path + "': " + err);
+    }
+    mSocket = fd;
+    mPath = path;
+}
+
+
+void EventServer::close() noexcept
+{
+    for (auto & client : mClients) {
+        ::close(client.fd);
+    }
+    mClients.clear();
+    if (mSocket >= 0) {
+        ::close(mSocket);
+        mSocket = -1;
+        unlink(mPath.c_str());
+    }
+}
+
+
+void EventServer::close_inherited() noexcept
+{
+    for (auto & client : mClients) {
+        ::close(client.fd);
+    }
+    mClients.clear();
+    if (mSocket >= 0) {
+        ::close(mSocket);
+        mSocket = -1;
+    }
+}
+
+
+bool EventServer::is_open() const noexcept
+{
+    return mSocket >= 0;
+}
+
+
+void EventServer::publish(const std::string & device, const std::string & event, const std::string & value)
+{
+    if (mClients.empty()) {
+        return;
+    }
+    timeval now;
+    gettimeofday(&now, nullptr);
+    char time[32];
+    snprintf(time, sizeof(time), "%ld.%06ld", static_cast<long>(now.tv_sec), static_cast<long>(now.tv_usec));
+    std::string line = std::string(time) + " " + device + " " + event + (value.empty() ? "" : " " + value) + "\n";
+
+    for (auto & client : mClients) {
+        if (client.closed || !matches(client, device, event)) {
+            continue;
+        }
+        if (client.out.size() + line.size() > MAX_BUFFER) {
+            client.closed = true;
+            mDropped++;
+            continue;
+        }
+        client.out += line;
+        flush(client);
+    }
+}
+
+
+std::vector<pollfd> EventServer::poll_fds() const
+{
+    std::vector<pollfd> fds;
+    if (mSocket < 0) {
+        return fds;
+    }
+    fds.push_back(pollfd{mSocket, POLLIN, 0});
+    for (auto & client : mClients) {
+        fds.push_back(pollfd{client.fd, static_cast<short>(client.out.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+    }
+    return fds;
+}
+
+
+void EventServer::update()
+{
+    if (mSocket < 0) {
+        return;
+    }
+    for (;;) {
+        int fd = accept(mSocket, nullptr, nullptr);
+        if (fd < 0) {
+            break;
+        }
+        if (mClients.size() >= MAX_CLIENTS) {
+            ::close(fd);
+            mDropped++;
+            continue;
+        }
+        setup_fd(fd);
+        mClients.push_back(Client());
+        mClients.back().fd = fd;
+    }
+
+    for (auto it = mClients.begin(); it != mClients.end(); ) {
+        if (!it->closed) {
+            receive(*it);
+        }
+        if (!it->closed) {
+            flush(*it);
+        }
+        if (it->closed) {
+            ::close(it->fd);
+            it = mClients.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+
+size_t EventServer::clients() const noexcept
+{
+    return mClients.size();
+}
+
+
+long EventServer::dropped() const noexcept
+{
+    return mDropped;
+}
+
+
+void EventServer::flush(Client & client) noexcept
+{
+    while (!client.out.empty()) {
+        ssize_t sent = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // disconnected
+                client.closed = true;
+            }
+            return;
+        }
+        client.out.erase(0, static_cast<size_t>(sent));
+    }
+}
+
+
+void EventServer::receive(Client & client)
+{
+    char buf[512];
+    for (;;) {
+        ssize_t len = recv(client.fd, buf, sizeof(buf), 0);
+        if (len == 0) {
+            client.closed = true;
+            return;
+        }
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                client.closed = true;
+            }
+            return;
+        }
+        client.in.append(buf, static_cast<size_t>(len));
+
+        size_t end;
+        while ((end = client.in.find('\n')) != std::string::npos) {
+            std::string line = client.in.substr(0, end);
+            client.in.erase(0, end + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            size_t space = line.find(' ');
+            if (line.empty()) {
+                continue;
+            }
+            if (space == std::string::npos) {
+                // only a device pattern
+                client.filters.push_back(std::make_pair(line, std::string("*")));
+            } else {
+                client.filters.push_back(std::make_pair(line.substr(0, space), line.substr(space + 1)));
+            }
+        }
+        if (client.in.size() > MAX_LINE) {
+            client.closed = true;
+            mDropped++;
+            return;
+        }
+    }
+}
+
+
+bool EventServer::matches(const Client & client, const std::string & device, const std::string & event) noexcept
+{
+    if (client.filters.empty()) {
+        return true;
+    }
+    for (auto & filter : client.filters) {
+        if (fnmatch(filter.first.c_str(), device.c_str(), 0) == 0 && fnmatch(filter.second.c_str(), event.c_str(), 0) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,159 @@
+/*
+ *  EventServer.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+
+#ifndef EVENTSERVER_H
+#define EVENTSERVER_H
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+
+
+/** Unix domain socket that pushes events to subscribed local clients.
+ *
+ * Every event is sent as a line "<unix time> <device> <event>\n". A client
+ * receives all events until it sends a filter line "<device> [<event>]",
+ * both are shell wildcard patterns (e.g. "* scan*"); after that only
+ * events matching one of its filters are sent. Sockets are non-blocking,
+ * a client that does not read its events before its buffer is full is
+ * disconnected, so it can never stall polling.
+ */
+class EventServer
+{
+public:
+    /// Maximal number of buffered bytes per client
+    static const size_t MAX_BUFFER;
+
+    /// Maximal number of clients
+    static const size_t MAX_CLIENTS;
+
+    /** Constructor
+     */
+    EventServer();
+
+    /** Destructor, closes the socket
+     */
+    ~EventServer() noexcept;
+
+    /**
+     * Listen on given path, replacing a stale socket
+     * @param path
+     */
+    void open(const std::string & path);
+
+    /**
+     * Disconnect all clients and remove the socket
+     */
+    void close() noexcept;
+
+    /**
+     * Close all descriptors in a forked child, the socket is left to the parent
+     */
+    void close_inherited() noexcept;
+
+    /**
+     * @return true iff listening
+     */
+    bool is_open() const noexcept;
+
+    /**
+     * Send event to all matching clients
+     * @param device
+     * @param event
+     * @param value new value of an int, fixed or string sensor, appended to the line if not empty
+     */
+    void publish(const std::string & device, const std::string & event, const std::string & value = std::string());
+
+    /**
+     * @return descriptors to wait for before calling update()
+     */
+    std::vector<pollfd> poll_fds() const;
+
+    /**
+     * Accept new clients, read filters and send buffered events without blocking
+     */
+    void update();
+
+    /**
+     * @return number of connected clients
+     */
+    size_t clients() const noexcept;
+
+    /**
+     * @return number of clients disconnected because they were too slow or misbehaved
+     */
+    long dropped() const noexcept;
+
+private:
+    /// Connected client
+    struct Client {
+        int fd;
+        /// Incomplete filter line
+        std::string in;
+        /// Events not sent yet
+        std::string out;
+        /// Pairs of device and event patterns
+        std::vector<std::pair<std::string, std::string>> filters;
+        /// Disconnect on next update
+        bool closed = false;
+    };
+
+    /// Listening socket
+    int mSocket = -1;
+
+    /// Socket path
+    std::string mPath;
+
+    /// Connected clients
+    std::list<Client> mClients;
+
+    /// Number of dropped clients
+    long mDropped = 0;
+
+    // Forbid copy
+    EventServer(const EventServer &);
+    EventServer & operator=(const EventServer &);
+
+    /**
+     * Send as much buffered data as possible
+     * @param client
+     */
+    void flush(Client & client) noexcept;
+
+    /**
+     * Read filter lines
+     * @param client
+     */
+    void receive(Client & client);
+
+    /**
+     * @param client
+     * @param device
+     * @param event
+     * @return true iff the client wants the event
+     */
+    static bool matches(const Client & client, const std::string & device, const std::string & event) noexcept;
+};
+
+#endif
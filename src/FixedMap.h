@@ -0,0 +1,166 @@
+/*
+ *  FixedMap.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+
+#ifndef FIXEDMAP_H
+#define FIXEDMAP_H
+
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+
+
+/** Map with a fixed capacity and no heap allocation of its own, for small tables.
+ *
+ * Elements are kept sorted by key in an array, so iteration order is the same
+ * as with std::map, and lookups are a linear search, which beats a tree for
+ * the handful of sensors a scanner has. Only the part of the std::map interface
+ * used by the daemon is provided, and iterators are invalidated by every change.
+ *
+ * @tparam K key type, must be default constructible and comparable with <
+ * @tparam V value type, must be default constructible
+ * @tparam N capacity
+ */
+template <typename K, typename V, size_t N>
+class FixedMap
+{
+public:
+    typedef std::pair<K, V> value_type;
+    typedef value_type * iterator;
+    typedef const value_type * const_iterator;
+
+    iterator begin() noexcept { return mItems; }
+    iterator end() noexcept { return mItems + mSize; }
+    const_iterator begin() const noexcept { return mItems; }
+    const_iterator end() const noexcept { return mItems + mSize; }
+
+    /**
+     * @return number of elements
+     */
+    size_t size() const noexcept
+    {
+        return mSize;
+    }
+
+    /**
+     * @return capacity
+     */
+    static constexpr size_t max_size() noexcept
+    {
+        return N;
+    }
+
+    /**
+     * @return true iff there are no elements
+     */
+    bool empty() const noexcept
+    {
+        return mSize == 0;
+    }
+
+    /**
+     * Remove all elements
+     */
+    void clear() noexcept
+    {
+        mSize = 0;
+    }
+
+    /**
+     * @param key
+     * @return element with given key, or end()
+     */
+    iterator find(const K & key)
+    {
+        iterator it = lower_bound(key);
+        return it != end() && !(key < it->first) ? it : end();
+    }
+
+    /**
+     * @param key
+     * @return value of given key, inserted if missing
+     * @throw std::length_error if the key is missing and the map is full
+     */
+    V & operator[](const K & key)
+    {
+        iterator it = lower_bound(key);
+        if (it != end() && !(key < it->first)) {
+            return it->second;
+        }
+        if (mSize == N) {
+            throw std::length_error("FixedMap is full");
+        }
+        for (iterator dest = end(); dest != it; --dest) {
+            *dest = std::move(*(dest - 1));
+        }
+        it->first = key;
+        it->second = V();
+        mSize++;
+        return it->second;
+    }
+
+    /**
+     * Remove given element
+     * @param pos
+     * @return iterator to the element after it
+     */
+    iterator erase(iterator pos)
+    {
+        for (iterator it = pos; it + 1 != end(); ++it) {
+            *it = std::move(*(it + 1));
+        }
+        mSize--;
+        return pos;
+    }
+
+    /**
+     * Exchange the contents with another map
+     * @param other
+     */
+    void swap(FixedMap & other)
+    {
+        for (size_t i = 0; i < N; ++i) {
+            std::swap(mItems[i], other.mItems[i]);
+        }
+        std::swap(mSize, other.mSize);
+    }
+
+private:
+    /// Elements, sorted by key
+    value_type mItems[N];
+
+    /// Number of elements
+    size_t mSize = 0;
+
+    /**
+     * @return first element whose key is not less than given key
+     */
+    iterator lower_bound(const K & key)
+    {
+        iterator it = begin();
+        while (it != end() && it->first < key) {
+            ++it;
+        }
+        return it;
+    }
+};
+
+#endif
@@ -0,0 +1,146 @@
+
+#include "GestureEngine.h"
+
+#include <algorithm>
+
+
+GestureEngine::GestureEngine(int long_ms, int double_ms, int chord_ms)
+{
+    set_thresholds(long_ms, double_ms, chord_ms);
+}
+
+
+void GestureEngine::set_thresholds(int long_ms, int double_ms, int chord_ms) noexcept
+{
+    mLongUs = static_cast<long long>(std::max(long_ms, 0)) * 1000;
+    mDoubleUs = static_cast<long long>(std::max(double_ms, 0)) * 1000;
+    mChordUs = static_cast<long long>(std::max(chord_ms, 0)) * 1000;
+}
+
+
+std::string GestureEngine::thresholds() const
+{
+    return std::to_string(mLongUs / 1000) + "," + std::to_string(mDoubleUs / 1000) + "," + std::to_string(mChordUs / 1000);
+}
+
+
+std::vector<std::string> GestureEngine::feed(long long time_us, const Sensors & sensors)
+{
+    std::vector<std::string> events;
+    for (size_t i = 0; i < sensors.size(); ++i) {
+        const std::string & name = sensors[i].first;
+        bool on = sensors[i].second;
+        Button & b = mButtons[name];
+        switch (b.state) {
+        case IDLE:
+            if (on) {
+                b.state = PRESSED;
+                b.pressed_us = time_us;
+                b.second = false;
+            }
+            break;
+        case PRESSED:
+            if (on) {
+                if (mLongUs > 0 && !b.second && time_us - b.pressed_us >= mLongUs) {
+                    events.push_back(name + ".long");
+                    b.state = HELD;
+                }
+            } else if (b.second) {
+                events.push_back(name + ".double");
+                b.state = IDLE;
+            } else if (mDoubleUs > 0) {
+                b.state = RELEASED;
+                b.released_us = time_us;
+            } else {
+                events.push_back(name);
+                b.state = IDLE;
+            }
+            break;
+        case RELEASED:
+            if (on) {
+                b.state = PRESSED;
+                b.pressed_us = time_us;
+                b.second = time_us - b.released_us <= mDoubleUs;
+                if (!b.second) {
+                    // too late for a double press
+                    events.push_back(name);
+                }
+            }
+            break;
+        case HELD:
+            if (!on) {
+                b.state = IDLE;
+            }
+            break;
+        }
+    }
+
+    // the window for a second press has passed, also if the poll failed
+    for (auto & entry : mButtons) {
+        Button & b = entry.second;
+        if (b.state == RELEASED && time_us - b.released_us > mDoubleUs) {
+            events.push_back(entry.first);
+            b.state = IDLE;
+        }
+    }
+
+    detect_chord(events);
+    return events;
+}
+
+
+bool GestureEngine::in_progress() const noexcept
+{
+    for (auto & entry : mButtons) {
+        if (entry.second.state == PRESSED || entry.second.state == RELEASED) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void GestureEngine::reset() noexcept
+{
+    mButtons.clear();
+}
+
+
+void GestureEngine::forget(const std::string & name) noexcept
+{
+    mButtons.erase(name);
+}
+
+
+void GestureEngine::detect_chord(std::vector<std::string> & events)
+{
+    if (mChordUs <= 0) {
+        return;
+    }
+    // mButtons is ordered by name, so chords are named in alphabetical order
+    std::vector<std::string> pressed;
+    long long first_us = 0;
+    long long last_us = 0;
+    for (auto & entry : mButtons) {
+        const Button & b = entry.second;
+        if (b.state != PRESSED) {
+            continue;
+        }
+        if (pressed.empty()) {
+            first_us = last_us = b.pressed_us;
+        }
+        first_us = std::min(first_us, b.pressed_us);
+        last_us = std::max(last_us, b.pressed_us);
+        pressed.push_back(entry.first);
+    }
+    if (pressed.size() < 2 || last_us - first_us > mChordUs) {
+        return;
+    }
+
+    std::string chord;
+    for (auto & name : pressed) {
+        chord += (chord.empty() ? "" : "+") + name;
+        mButtons[name].state = HELD;
+    }
+    events.push_back(chord);
+}
@@ -0,0 +1,136 @@
+/*
+ *  GestureEngine.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+
+#ifndef GESTUREENGINE_H
+#define GESTUREENGINE_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/** Turns the sampled button states into gesture events.
+ *
+ * A button released before the long press threshold produces its plain
+ * name, e.g. "scan", but only after the double press window has passed
+ * without a second press. A second press within that window produces
+ * "scan.double", holding a button produces "scan.long" and pressing
+ * several buttons within the chord window produces their names in
+ * alphabetical order, e.g. "copy+scan". Buttons are only timed while a
+ * gesture is in progress, see in_progress().
+ */
+class GestureEngine
+{
+public:
+    /// Sampled sensors, as in SensorSample
+    typedef std::vector<std::pair<std::string, bool>> Sensors;
+
+    /** Constructor
+     * @param long_ms hold time for a long press, 0 to disable
+     * @param double_ms longest pause between two presses of a double press, 0 to disable
+     * @param chord_ms longest time between pressing the buttons of a chord, 0 to disable
+     */
+    GestureEngine(int long_ms, int double_ms, int chord_ms);
+
+    /**
+     * Change thresholds, see constructor
+     * @param long_ms
+     * @param double_ms
+     * @param chord_ms
+     */
+    void set_thresholds(int long_ms, int double_ms, int chord_ms) noexcept;
+
+    /**
+     * @return thresholds in ms as "LONG,DOUBLE,CHORD"
+     */
+    std::string thresholds() const;
+
+    /**
+     * Process a sample
+     * @param time_us monotonic time of the sample
+     * @param sensors sensor states, empty if the poll failed
+     * @return recognized gestures
+     */
+    std::vector<std::string> feed(long long time_us, const Sensors & sensors);
+
+    /**
+     * @return true iff a gesture is in progress and samples should be taken more often
+     */
+    bool in_progress() const noexcept;
+
+    /**
+     * Forget all button states
+     */
+    void reset() noexcept;
+
+    /**
+     * Forget the state of a single button, e.g. while its readings cannot be trusted,
+     * so that a press in progress neither completes nor produces a gesture
+     * @param name sensor name
+     */
+    void forget(const std::string & name) noexcept;
+
+private:
+    /// Button states
+    enum State {
+        /// Not pressed
+        IDLE,
+        /// Pressed, no gesture recognized yet
+        PRESSED,
+        /// Released, waiting for a second press
+        RELEASED,
+        /// Gesture was recognized, waiting for release
+        HELD
+    };
+
+    /// State of a single button
+    struct Button {
+        State state = IDLE;
+        /// Time of the last press
+        long long pressed_us = 0;
+        /// Time of the last release
+        long long released_us = 0;
+        /// true iff the current press is the second one of a double press
+        bool second = false;
+    };
+
+    /// Long press threshold in us
+    long long mLongUs;
+
+    /// Double press window in us
+    long long mDoubleUs;
+
+    /// Chord window in us
+    long long mChordUs;
+
+    /// Buttons by sensor name
+    std::map<std::string, Button> mButtons;
+
+    /**
+     * Emit a chord if several buttons were pressed at the same time
+     * @param events
+     */
+    void detect_chord(std::vector<std::string> & events);
+};
+
+#endif
@@ -3,195 +3,1698 @@
 #include "InsaneException.h"
 
 #include <cassert>
-#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
 #include <cstdlib>
 #include <stdexcept>
 #include <csignal>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <syslog.h>
 #include <cerrno>
 #include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <thread>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 
 #include "Timer.h"
+#include "TraceLog.h"
+#include "config.h"
+
+// POSIX does not declare it in any header
+extern char ** environ;
+
+
+namespace {
+
+/**
+ * @return resident memory of this process in kB, or -1 if unknown
+ */
+long resident_kb() noexcept
+{
+    long size = 0;
+    long resident = -1;
+    FILE * f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &size, &resident) != 2) {
+            resident = -1;
+        }
+        fclose(f);
+    }
+    return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+/**
+ * @param sorted
+ * @param fraction e.g. 0.9 for the 90th percentile
+ * @return nearest-rank percentile of the given sorted values in ms
+ */
+double percentile_ms(const std::vector<long long> & sorted, double fraction)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(fraction * sorted.size() + 0.999999);
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1] / 1000.0;
+}
+
+
+/**
+ * Let the kernel delay timer expirations of the calling thread by up to given time,
+ * so that wakeups of the whole system can be coalesced
+ */
+void set_timer_slack(long ms) noexcept
+{
+#if defined(__linux__) && defined(PR_SET_TIMERSLACK)
+    prctl(PR_SET_TIMERSLACK, static_cast<unsigned long>(ms) * 1000000UL, 0, 0, 0);
+#else
+    (void) ms;
+#endif
+}
+
+
+/**
+ * Create a non-blocking pipe used to wake up a thread
+ * @return false on error
+ */
+bool make_wake_pipe(int fds[2]) noexcept
+{
+    if (pipe(fds) < 0) {
+        return false;
+    }
+    for (int i = 0; i < 2; ++i) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    return true;
+}
+
+
+/**
+ * Wake up the thread waiting for the pipe
+ */
+void notify(int fd) noexcept
+{
+    char c = 0;
+    // a full pipe will wake it up anyway
+    if (write(fd, &c, 1) < 0) {
+        return;
+    }
+}
+
+
+/**
+ * Consume all pending wake ups
+ */
+void drain(int fd) noexcept
+{
+    char buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+}
+
+
+/**
+ * @return text without leading and trailing blanks
+ */
+std::string trim(const std::string & text)
+{
+    size_t start = text.find_first_not_of(" \t\r");
+    if (start == std::string::npos) {
+        return "";
+    }
+    return text.substr(start, text.find_last_not_of(" \t\r") - start + 1);
+}
+
+
+/**
+ * @return non-empty items of a comma separated list
+ */
+std::vector<std::string> split_list(const std::string & text)
+{
+    std::vector<std::string> result;
+    std::string item;
+    std::istringstream in(text);
+    while (std::getline(in, item, ',')) {
+        item = trim(item);
+        if (!item.empty()) {
+            result.push_back(item);
+        }
+    }
+    return result;
+}
+
+
+/**
+ * @return value of a yes/no setting
+ */
+bool parse_bool(const std::string & value)
+{
+    if (value == "yes" || value == "true" || value == "1") {
+        return true;
+    }
+    if (value == "no" || value == "false" || value == "0") {
+        return false;
+    }
+    throw std::invalid_argument("Expected yes or no");
+}
+
+
+/**
+ * Read "key = value" lines, ignoring blank lines and lines starting with #
+ * @return settings, the last one wins if a key is repeated
+ */
+std::map<std::string, std::string> read_config(const std::string & path)
+{
+    std::ifstream in(path);
+    if (!in) {
+        throw InsaneException("Could not read configuration file '" + path + "': " + strerror(errno));
+    }
+    std::map<std::string, std::string> config;
+    std::string line;
+    for (int number = 1; std::getline(in, line); ++number) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        auto pos = line.find('=');
+        if (pos == std::string::npos || trim(line.substr(0, pos)).empty()) {
+            throw InsaneException("Syntax error in '" + path + "' line " + std::to_string(number) + ", expected key = value");
+        }
+        config[trim(line.substr(0, pos))] = trim(line.substr(pos + 1));
+    }
+    return config;
+}
+
+}
 
 
 const std::string InsaneDaemon::NAME = "insaned";
 
 const int InsaneDaemon::SKIP_TIMEOUT_MS = 2500;
 const int InsaneDaemon::BUSY_TIMEOUT_MS = 15000;
+const int InsaneDaemon::PAUSE_TIMEOUT_MS = 60000;
+const int InsaneDaemon::ENUM_DEADLINE_MS = 5000;
+const int InsaneDaemon::GESTURE_BURST_MS = 50;
+const int InsaneDaemon::LATE_POLL_MS = 10;
+const int InsaneDaemon::POWER_BURST_SAMPLES = 3;
+const int InsaneDaemon::POWER_TIMER_SLACK_MS = 100;
 
 InsaneDaemon InsaneDaemon::mInstance;
 
 
-InsaneDaemon & InsaneDaemon::instance() noexcept
-{
-    return InsaneDaemon::mInstance;
+InsaneDaemon & InsaneDaemon::instance() noexcept
+{
+    return InsaneDaemon::mInstance;
+}
+
+
+InsaneDaemon::InsaneDaemon()
+{
+#ifdef SIGHUP
+    signal (SIGHUP, InsaneDaemon::sighandler);
+#endif
+#ifdef SIGPIPE
+    signal (SIGPIPE, InsaneDaemon::sighandler);
+#endif
+#ifdef SIGUSR1
+    signal (SIGUSR1, InsaneDaemon::sighandler);
+#endif
+#ifdef SIGCHLD
+    signal (SIGCHLD, InsaneDaemon::sighandler);
+#endif
+    signal (SIGINT, InsaneDaemon::sighandler);
+    signal (SIGTERM, InsaneDaemon::sighandler);
+}
+
+
+InsaneDaemon::~InsaneDaemon() noexcept
+{
+    log("Exiting...", 1);
+    mProxy.stop();
+    close();
+    try {
+        mHandle = nullptr;
+        if (mEnumThread.joinable()) {
+            if (mEnumDone) {
+                mEnumThread.join();
+            } else {
+                // sane_exit must not be called while it runs
+                log("Device enumeration is still running, not calling sane_exit", 1);
+                mEnumThread.detach();
+                mSaneInitialized = false;
+            }
+        }
+        if (mSaneInitialized) {
+            log("Calling sane_exit", 1);
+            mSane.exit();
+        }
+
+        ::close(0);
+        ::close(1);
+        ::close(2);
+
+        log("Finished", 1);
+    } catch (...) {
+        log("Error calling sane_exit!", 0);
+    }
+}
+
+
+void InsaneDaemon::init(std::string device_name, std::string events_dir, int sleep_ms, int verbose, bool log_to_syslog, bool suspend_after_event)
+{
+    set_current_device(device_name);
+    mEventsDir = events_dir;
+    mSleepMs = sleep_ms;
+    if (mSleepMs <= 1) {
+        throw std::out_of_range("Value of sleep ms is out of range");
+    }
+    mHealth.set_period(mSleepMs);
+    mVerbose = verbose;
+    mLogToSyslog = log_to_syslog;
+    mSuspendAfterEvent = suspend_after_event;
+}
+
+
+void InsaneDaemon::load_backend()
+{
+    if (mSaneInitialized) {
+        throw InsaneException("SANE is already initialized, cannot load backend directly");
+    }
+    std::string device_name = mCurrentDevice;
+    if (device_name.empty()) {
+        const char * defname = getenv("SANE_DEFAULT_DEVICE");
+        if (defname != nullptr) {
+            device_name = std::string(defname);
+        }
+    }
+    auto pos = device_name.find(':');
+    if (device_name.empty() || pos == 0) {
+        throw InsaneException("Device name including the backend (e.g. genesys:libusb:001:003) is required to load the backend directly");
+    }
+    mSane.load(device_name.substr(0, pos));
+    log("Loaded backend '" + mSane.name() + "' from '" + mSane.path() + "'", 1);
+}
+
+
+void InsaneDaemon::init_sane() noexcept
+{
+    if (mSaneInitialized) {
+        return;
+    }
+    mSaneInitialized = true;
+    log("Initializing...", 1);
+    Timer t;
+    if (!checkStatus(mSane.init(&mVersionCode, nullptr), "sane_init")) {
+        log("error, failed to initialize SANE library!", 0);
+    }
+    long ms = t.restart();
+    log("timer: sane_init (" + mSane.name() + "): " + std::to_string(ms) + " ms, resident memory: "
+        + std::to_string(resident_kb()) + " kB", 2);
+}
+
+
+void InsaneDaemon::open(std::string device_name)
+{
+    close();
+    init_sane();
+    // stays set if anything below throws
+    mOpenFailed = true;
+
+    Timer t;
+    if (device_name.empty())
+    {
+        /* If no device name was specified explicitly, we look at the
+           environment variable SANE_DEFAULT_DEVICE.  If this variable
+           is not set, we open the first device we find (if any): */
+        const char * defname = getenv("SANE_DEFAULT_DEVICE");
+        if (defname != nullptr) {
+            device_name = std::string(defname);
+        } else {
+            device_name = get_devices().at(0);
+        }
+    }
+    log("Opening device '" + device_name + "'", 2);
+    set_current_device(device_name);
+
+    INSANE_PROBE1(open_start, device_name.c_str());
+    INSANE_TRACE_BEGIN("sane_open", device_name);
+    SANE_Status status = mSane.open(device_name.c_str(), &mHandle);
+    INSANE_PROBE2(open_end, device_name.c_str(), static_cast<int>(status));
+    INSANE_TRACE_END("sane_open", sane_strstatus(status));
+    if (!checkStatus(status, "opening device '" + device_name + "'")) {
+        if (device_name[0] == '/') {
+            fputs("\nYou seem to have specified a UNIX device name, or filename instead of selecting\n"
+                  "the SANE scanner or image acquisition device you want to use. As an example,\n"
+                  "you might want \"epson:/dev/sg0\" or \"hp:/dev/usbscanner0\". If any supported\n"
+                  "devices are installed in your system, you should be able to see a list with\n"
+                  "\"scanimage --list-devices\".\n", stderr);
+        }
+        throw InsaneException("Failed to open device '" + device_name + "'");
+    }
+    long long open_us = t.restart_us();
+    log("timer: sane_open: " + std::to_string(open_us / 1000) + " ms", 2);
+    timing("sane_open", "", open_us);
+    mOpenFailed = false;
+}
+
+
+void InsaneDaemon::close() noexcept
+{
+    try {
+        if (mHandle)
+        {
+            log("Closing device '" + mCurrentDevice + "'", 2);
+            Timer t;
+            INSANE_PROBE1(close_start, mCurrentDevice.c_str());
+            INSANE_TRACE_BEGIN("sane_close", mCurrentDevice);
+            mSane.close(mHandle);
+            INSANE_PROBE1(close_end, mCurrentDevice.c_str());
+            INSANE_TRACE_END("sane_close", "");
+            long long close_us = t.restart_us();
+            log("timer: sane_close: " + std::to_string(close_us / 1000) + " ms", 2);
+            timing("sane_close", "", close_us);
+
+        }
+    } catch (...) {
+        log("Error closing device!", 0);
+    }
+    mHandle = nullptr;
+}
+
+
+void InsaneDaemon::run()
+{
+    mRun = true;
+    if (!mServerPath.empty()) {
+        // not before fork, the parent process would remove the socket on exit
+        mServer.open(mServerPath);
+        log("Publishing events on '" + mServerPath + "'", 1);
+    }
+    if (mProxyPort > 0) {
+        if (mIsolated) {
+            throw InsaneException("The saned proxy needs SANE in the daemon process and cannot be used with an isolated poller");
+        }
+        mProxy.set_functions([this]() { return current_device(); },
+                             [this]() { init_sane(); },
+                             [this](const std::string & message, int verbosity) { log(message, verbosity); });
+        mProxy.start(mProxyPort);
+        log("Serving the polled device to SANE net clients on port " + std::to_string(mProxyPort) + " of localhost", 1);
+    }
+    mWatcher.update();
+    if (mIsolated) {
+        // SANE must not be initialized before the poller process is forked
+        log("Polling sensors in a separate process with a deadline of " + std::to_string(mPollDeadlineMs) + " ms", 1);
+    } else if (mCurrentDevice.empty()) {
+        // sane_get_devices may take long, e.g. with the net backend
+        start_enumeration();
+    } else if (!mWatcher.any_running()) {
+        // fail early if the given device cannot be opened
+        OpenGuard g(mCurrentDevice);
+    }
+
+    log("Starting polling sensors of " + (mCurrentDevice.empty() ? std::string("the first device found") : mCurrentDevice)
+        + " every " + std::to_string(mSleepMs) + " ms", 1);
+    if (mPowerSave) {
+        setup_power_save();
+    }
+    if (mThreaded) {
+        run_threaded();
+        mProxy.stop();
+        log_stats(1);
+        return;
+    }
+    while (mRun) {
+        long long next_ms = mSleepMs;
+        int wake_fd = -1;
+        mWakeups++;
+        log_signal();
+        reap_handlers();
+        if (mReloadRequested) {
+            mReloadRequested = false;
+            reload_config();
+        }
+        mWatcher.update();
+        merge_devices();
+        bool waiting = mPoller.pending();
+        if (waiting && mPoller.ready()) {
+            receive_isolated();
+            waiting = false;
+            next_ms = poll_delay_ms();
+        } else if (!waiting && poll_allowed(next_ms, wake_fd)) {
+            if (poll_due() && mIsolated) {
+                // the loop keeps serving signals and clients until the poller process answers
+                request_isolated();
+                waiting = mPoller.pending();
+            } else if (poll_due()) {
+                poll_once();
+                schedule_poll();
+            }
+            next_ms = poll_delay_ms();
+        } else if (!waiting) {
+            mPollScheduled = false;
+        }
+        if (waiting) {
+            // the deadline is a timer, not a blocking read
+            next_ms = mPoller.time_left_ms();
+            wake_fd = mPoller.fd();
+        }
+
+        if (mStatsRequested) {
+            mStatsRequested = false;
+            log_stats(0);
+        }
+        wait_events(next_ms, wake_fd);
+    }
+    log_signal();
+    mProxy.stop();
+    log_stats(1);
+}
+
+
+void InsaneDaemon::run_threaded()
+{
+    if (!make_wake_pipe(mQueuePipe) || !make_wake_pipe(mPollerPipe)) {
+        throw InsaneException(std::string("Could not create pipe: ") + strerror(errno));
+    }
+    log("Polling sensors in a separate thread", 1);
+
+    // signals must interrupt the sleep of this thread, the poller thread blocks them all
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    std::thread poller;
+    try {
+        poller = std::thread(&InsaneDaemon::poller_thread, this);
+    } catch (...) {
+        pthread_sigmask(SIG_SETMASK, &old, nullptr);
+        throw;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+
+    while (mRun) {
+        long long next_ms = mSleepMs;
+        int wake_fd = mQueuePipe[0];
+        mWakeups++;
+        log_signal();
+        reap_handlers();
+        if (mReloadRequested) {
+            mReloadRequested = false;
+            reload_config();
+        }
+        mWatcher.update();
+
+        drain(mQueuePipe[0]);
+        QueuedSample item;
+        while (mQueue.pop(item)) {
+            long long latency_us = Timer::monotonic_us() - item.queued_us;
+            mQueueMaxDepth = std::max<long>(mQueueMaxDepth, static_cast<long>(mQueue.size()) + 1);
+            mQueueLatencyMaxUs = std::max<long long>(mQueueLatencyMaxUs, latency_us);
+            mQueueLatencySumUs += latency_us;
+            mQueuePopped++;
+            handle_sample(item.sample);
+        }
+
+        // closing the gate right after a handler was started keeps the poller away from the device
+        bool allowed = poll_allowed(next_ms, wake_fd);
+        if (allowed != mPollGate) {
+            mPollGate = allowed;
+            notify(mPollerPipe[1]);
+        }
+        if (mStatsRequested) {
+            mStatsRequested = false;
+            log_stats(0);
+        }
+        if (allowed && mPowerSave) {
+            // the poller wakes this thread up when a sample is ready
+            next_ms = std::max(next_ms, mPowerIdleMs);
+        }
+        wait_events(next_ms, wake_fd);
+    }
+    log_signal();
+
+    notify(mPollerPipe[1]);
+    poller.join();
+    for (int fd : {mQueuePipe[0], mQueuePipe[1], mPollerPipe[0], mPollerPipe[1]}) {
+        ::close(fd);
+    }
+    mQueuePipe[0] = mQueuePipe[1] = mPollerPipe[0] = mPollerPipe[1] = -1;
+}
+
+
+void InsaneDaemon::poller_thread() noexcept
+{
+    if (mPowerSave) {
+        // timer slack is per thread
+        set_timer_slack(POWER_TIMER_SLACK_MS);
+    }
+    while (mRun) {
+        long long next_ms = mSleepMs;
+        mWakeups++;
+        merge_devices();
+        if (mPollGate) {
+            if (poll_due()) {
+                QueuedSample item;
+                item.sample = take_sample();
+                item.queued_us = Timer::monotonic_us();
+                if (mQueue.push(std::move(item))) {
+                    notify(mQueuePipe[1]);
+                } else {
+                    mQueueDrops++;
+                }
+                schedule_poll();
+            }
+            next_ms = poll_delay_ms();
+        } else {
+            mPollScheduled = false;
+        }
+        sleep_ms(next_ms, mPollerPipe[0]);
+        drain(mPollerPipe[0]);
+    }
+}
+
+
+void InsaneDaemon::start_enumeration()
+{
+    init_sane();
+    const char * defname = getenv("SANE_DEFAULT_DEVICE");
+    if (defname != nullptr) {
+        set_current_device(defname);
+    } else {
+        std::ifstream cache(DEVICE_CACHE_FILE);
+        std::string cached;
+        std::getline(cache, cached);
+        set_current_device(cached);
+    }
+    mWaitingForDevice = mCurrentDevice.empty();
+    mEnumPending = true;
+    mEnumStartUs = Timer::monotonic_us();
+    log("Looking for devices in background" + (mWaitingForDevice ? std::string("") : ", then polling '" + mCurrentDevice + "'"), 1);
+    mEnumThread = std::thread(&InsaneDaemon::enumerate_devices, this);
+}
+
+
+void InsaneDaemon::enumerate_devices() noexcept
+{
+    std::vector<std::string> found;
+    try {
+        Timer t;
+        {
+            // SANE is not reentrant, polls and SANE net clients wait until the list is complete
+            std::lock_guard<std::mutex> sane_lock(mSaneMutex);
+            const SANE_Device ** device_list = nullptr;
+            SANE_Status status = mSane.get_devices(&device_list, SANE_FALSE);
+            if (status == SANE_STATUS_GOOD) {
+                for (int i = 0; device_list[i]; ++i) {
+                    found.push_back(device_list[i]->name);
+                }
+            } else {
+                log("sane_get_devices failed: " + std::string(sane_strstatus(status)), 0);
+            }
+        }
+        log("timer: sane_get_devices: " + std::to_string(t.restart()) + " ms", 2);
+        std::lock_guard<std::mutex> lock(mEnumMutex);
+        mFoundDevices.swap(found);
+    } catch (std::exception & e) {
+        log(std::string("Could not list SANE devices: ") + e.what(), 0);
+    }
+    mEnumDone = true;
+}
+
+
+void InsaneDaemon::merge_devices()
+{
+    if (!mEnumPending) {
+        return;
+    }
+    if (!mEnumDone) {
+        if (!mEnumLate && Timer::monotonic_us() - mEnumStartUs > ENUM_DEADLINE_MS * 1000LL) {
+            mEnumLate = true;
+            log("warning, looking for devices takes longer than " + std::to_string(ENUM_DEADLINE_MS)
+                + " ms, use --device-name to start polling earlier", 0);
+        }
+        return;
+    }
+    // the poller thread or a SANE net client may be using the device
+    std::unique_lock<std::mutex> lock(mSaneMutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return;
+    }
+    mEnumPending = false;
+    mEnumThread.join();
+    std::vector<std::string> found;
+    {
+        std::lock_guard<std::mutex> enum_lock(mEnumMutex);
+        found.swap(mFoundDevices);
+    }
+    log("Found " + std::to_string(found.size()) + " devices in "
+        + std::to_string((Timer::monotonic_us() - mEnumStartUs) / 1000) + " ms", 1);
+    if (found.empty()) {
+        if (mWaitingForDevice) {
+            log("No SANE devices found", 0);
+            mRun = false;
+        }
+        return;
+    }
+    mDevices = found;
+    bool known = std::find(found.begin(), found.end(), mCurrentDevice) != found.end();
+    if (mWaitingForDevice || (!known && mHealth.state() != DeviceHealth::HEALTHY)) {
+        if (!mWaitingForDevice) {
+            log("'" + mCurrentDevice + "' is not available, switching to '" + found[0] + "'", 0);
+        }
+        set_current_device(found[0]);
+        mWaitingForDevice = false;
+        mRestartPoller = true;
+    } else if (!known) {
+        log("'" + mCurrentDevice + "' was not found, but can be polled", 1);
+    }
+    if (getenv("SANE_DEFAULT_DEVICE") == nullptr) {
+        std::ofstream cache(DEVICE_CACHE_FILE);
+        cache << mCurrentDevice << std::endl;
+        if (!cache) {
+            log("Could not write '" + std::string(DEVICE_CACHE_FILE) + "'", 2);
+        }
+    }
+}
+
+
+bool InsaneDaemon::poll_due() const noexcept
+{
+    long long now_us = Timer::monotonic_us();
+    return now_us >= mNextPollUs && mHealth.may_poll(now_us);
+}
+
+
+void InsaneDaemon::schedule_poll() noexcept
+{
+    long long now_us = Timer::monotonic_us();
+    long long next_ms = mHealth.next_poll_ms(now_us);
+    if (mHealth.state() == DeviceHealth::HEALTHY) {
+        if (mBurst) {
+            // sample faster only while a button is being timed
+            next_ms = std::min<long long>(next_ms, GESTURE_BURST_MS);
+        } else if (mPowerSave && mBurstLeft <= 0) {
+            // give the device time to autosuspend before the next burst
+            mBurstLeft = POWER_BURST_SAMPLES;
+            next_ms = std::max(next_ms, mPowerIdleMs);
+        }
+    }
+    mNextPollUs = now_us + next_ms * 1000;
+    mPollScheduled = true;
+}
+
+
+long long InsaneDaemon::poll_delay_ms() const noexcept
+{
+    long long now_us = Timer::monotonic_us();
+    long long ms = (mNextPollUs - now_us + 999) / 1000;
+    if (!mHealth.may_poll(now_us)) {
+        ms = std::max(ms, mHealth.next_poll_ms(now_us));
+    }
+    return std::max(ms, 1LL);
+}
+
+
+void InsaneDaemon::setup_power_save()
+{
+    set_timer_slack(POWER_TIMER_SLACK_MS);
+    mPowerStartUs = Timer::monotonic_us();
+    long delay_ms = -1;
+    if (mUsb.find(mCurrentDevice)) {
+        delay_ms = mUsb.autosuspend_delay_ms();
+        mSuspendedStartMs = mUsb.suspended_time_ms();
+        if (mUsb.control() != "auto" || delay_ms < 0) {
+            log("warning, autosuspend is disabled for '" + mCurrentDevice + "', enable it with: echo auto > "
+                + mUsb.path() + "/power/control", 0);
+        }
+    } else {
+        log("warning, cannot find '" + mCurrentDevice + "' in " + USB_SYSFS_DIR + ", suspended time will not be reported", 0);
+    }
+    if (mPowerIdleMs <= 0) {
+        // the device has to stay idle for the whole delay, then sleep for a while
+        long delay = delay_ms >= 0 ? delay_ms : DEFAULT_AUTOSUSPEND_DELAY_MS;
+        mPowerIdleMs = std::max(delay + 1000, 2 * delay);
+    }
+    mPowerIdleMs = std::max<long long>(mPowerIdleMs, mSleepMs);
+    log("Power saving: polling " + std::to_string(POWER_BURST_SAMPLES) + " times every " + std::to_string(mSleepMs)
+        + " ms, then pausing for " + std::to_string(mPowerIdleMs) + " ms (autosuspend delay: "
+        + (delay_ms >= 0 ? std::to_string(delay_ms) + " ms" : std::string("unknown")) + ")", 1);
+}
+
+
+bool InsaneDaemon::poll_allowed(long long & next_ms, int & wake_fd) noexcept
+{
+    if (mWatcher.any_running()) {
+        if (!mPaused) {
+            mPaused = true;
+            log("Polling is paused while " + mWatcher.running() + " is running", 1);
+        }
+        // without the proc connector, /proc is scanned once per period
+        if (mWatcher.fd() >= 0) {
+            wake_fd = mWatcher.fd();
+            next_ms = PAUSE_TIMEOUT_MS;
+        }
+        return false;
+    }
+    if (mPaused) {
+        mPaused = false;
+        log("Polling is resumed", 1);
+    }
+    if (mWaitingForDevice) {
+        log("Waiting for the list of devices", 2);
+        return false;
+    }
+    if (mEnumPending && !mEnumDone) {
+        // skip instead of taking a busy sample, which would suspend polling
+        log("Reading sensors is suspended while looking for devices", 2);
+        return false;
+    }
+    if (mProxy.in_use()) {
+        log("Reading sensors is suspended while a SANE net client uses the device", 2);
+        return false;
+    }
+    if (!mPollDuringHandlers && !mHandlers.empty()) {
+        // a handler that scans would lose the race for the device against our sane_open
+        log("Reading sensors is suspended while an event handler script is running", 2);
+        return false;
+    }
+    // a deadline, because every signal, client or handler exit wakes the main loop up
+    long long left_us = mSuspendUntilUs - Timer::monotonic_us();
+    if (left_us > 0) {
+        next_ms = (left_us + 999) / 1000;
+        log("Reading sensors is suspended for " + std::to_string(next_ms) + " more ms", 2);
+        return false;
+    }
+    // TODO skip reading sensors if some file (e.g. libsane) is opened by another process
+    return true;
+}
+
+
+void InsaneDaemon::poll_once()
+{
+    handle_sample(take_sample());
+}
+
+
+SensorSample InsaneDaemon::take_sample() noexcept
+{
+    count_lateness();
+    std::unique_lock<std::mutex> lock(mSaneMutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        // a SANE net client has just opened the device
+        SensorSample sample;
+        sample.time_us = Timer::monotonic_us();
+        sample.status = SANE_STATUS_DEVICE_BUSY;
+        return sample;
+    }
+    prepare_poll();
+    return finish_sample(mIsolated ? poll_isolated() : poll());
+}
+
+
+void InsaneDaemon::request_isolated()
+{
+    count_lateness();
+    prepare_poll();
+    std::string error;
+    INSANE_TRACE_BEGIN("poll_isolated", std::to_string(mPoller.pid()));
+    if (!mPoller.request(mPollDeadlineMs, error)) {
+        handle_sample(finish_sample(isolated_result(false, SensorSample(), error)));
+        schedule_poll();
+    }
+}
+
+
+void InsaneDaemon::receive_isolated()
+{
+    SensorSample sample;
+    std::string error;
+    bool ok = false;
+    try {
+        ok = mPoller.receive(sample, error);
+    } catch (std::exception & e) {
+        error = e.what();
+    }
+    handle_sample(finish_sample(isolated_result(ok, sample, error)));
+    schedule_poll();
+}
+
+
+void InsaneDaemon::count_lateness() noexcept
+{
+    if (!mPollScheduled) {
+        return;
+    }
+    // e.g. handlers hogging the CPU delay the wakeup of the poller
+    long long late_us = std::max(0LL, Timer::monotonic_us() - mNextPollUs);
+    std::lock_guard<std::mutex> stats_lock(mStatsMutex);
+    mTimedPolls++;
+    mPollLateSumUs += late_us;
+    mPollLateMaxUs = std::max(mPollLateMaxUs, late_us);
+    if (late_us > LATE_POLL_MS * 1000LL) {
+        mLatePolls++;
+    }
+    mPollScheduled = false;
+}
+
+
+void InsaneDaemon::prepare_poll() noexcept
+{
+    log("Reading sensors...", 2);
+    if (mPeriodChanged.exchange(false)) {
+        std::lock_guard<std::mutex> stats_lock(mStatsMutex);
+        mHealth.set_period(mSleepMs);
+    }
+    if (mRestartPoller) {
+        mRestartPoller = false;
+        mSensors.clear();
+        mDevices.clear();
+        mPoller.stop();
+    }
+}
+
+
+SensorSample InsaneDaemon::finish_sample(SensorSample sample) noexcept
+{
+    update_health(sample);
+    mPolls++;
+    if (mPowerSave) {
+        // keep sampling at full rate while a button is pressed
+        bool pressed = false;
+        for (auto & sensor : sample.sensors) {
+            pressed = pressed || sensor.second;
+        }
+        mBurstLeft = pressed ? POWER_BURST_SAMPLES : mBurstLeft - 1;
+    }
+    return sample;
+}
+
+
+void InsaneDaemon::handle_sample(const SensorSample & sample)
+{
+    if (sample.status == SANE_STATUS_DEVICE_BUSY) {
+        mSuspendUntilUs = Timer::monotonic_us() + BUSY_TIMEOUT_MS * 1000LL;
+    }
+    try {
+        mTrace.write(sample);
+    } catch (InsaneException & e) {
+        log(std::string(e.what()) + ", recording stopped", 0);
+        mTrace.close();
+    }
+    dispatch(sample);
+    mBurst = mGesturesEnabled && mGestures.in_progress();
+}
+
+
+void InsaneDaemon::pause_while(const std::vector<std::string> & names)
+{
+    if (mWatcher.start(names)) {
+        log("Watching processes using the proc connector", 2);
+    } else {
+        log("Proc connector is not available (missing CAP_NET_ADMIN?), will scan /proc every period", 1);
+    }
+}
+
+
+void InsaneDaemon::power_save(int idle_ms)
+{
+    mPowerSave = true;
+    mPowerIdleMs = idle_ms;
+}
+
+
+void InsaneDaemon::serve_sane(int port)
+{
+    mProxyPort = port;
+}
+
+
+void InsaneDaemon::serve_events(const std::string & socket_path)
+{
+    mServerPath = socket_path;
+}
+
+
+void InsaneDaemon::threads()
+{
+    mThreaded = true;
+}
+
+
+void InsaneDaemon::poll_during_handlers()
+{
+    mPollDuringHandlers = true;
+}
+
+
+void InsaneDaemon::gestures(int long_ms, int double_ms, int chord_ms)
+{
+    mGestures.set_thresholds(long_ms, double_ms, chord_ms);
+    mGesturesEnabled = true;
+    log("Recognizing gestures: long press " + std::to_string(long_ms) + " ms, double press " + std::to_string(double_ms)
+        + " ms, chord " + std::to_string(chord_ms) + " ms", 1);
+}
+
+
+void InsaneDaemon::handler_class(const std::string & spec)
+{
+    ResourceClass limits(spec);
+    limits.prepare();
+    mHandlerClass = limits;
+    log("Event handler scripts run with " + (mHandlerClass.empty() ? std::string("no limits") : mHandlerClass.spec()), 1);
+}
+
+
+void InsaneDaemon::journal(const std::string & journal_file)
+{
+    mJournal.open(journal_file, true);
+    log("Writing event journal to '" + journal_file + "'", 1);
+}
+
+
+void InsaneDaemon::config(const std::string & config_file)
+{
+    // the daemon changes to / before it is reloaded
+    char * path = realpath(config_file.c_str(), nullptr);
+    if (!path) {
+        throw InsaneException("Could not open configuration file '" + config_file + "': " + strerror(errno));
+    }
+    mConfigPath = path;
+    free(path);
+    mConfig = read_config(mConfigPath);
+    for (auto & entry : mConfig) {
+        try {
+            mBaseline[entry.first] = setting(entry.first);
+            apply_setting(entry.first, entry.second);
+        } catch (InsaneException & e) {
+            throw InsaneException("Could not apply '" + entry.first + " = " + entry.second + "' from '" + config_file + "': " + e.what());
+        } catch (std::exception & e) {
+            throw InsaneException("Could not apply '" + entry.first + " = " + entry.second + "' from '" + config_file + "': " + e.what());
+        }
+    }
+    log("Applied " + std::to_string(mConfig.size()) + " settings from '" + config_file + "'", 1);
+}
+
+
+void InsaneDaemon::apply_setting(const std::string & key, const std::string & value)
+{
+    if (key == "events-dir") {
+        if (value.empty()) {
+            throw std::invalid_argument("The directory must not be empty");
+        }
+        mEventsDir = value;
+    } else if (key == "sleep-ms") {
+        int sleep_ms = std::stoi(value);
+        if (sleep_ms <= 1) {
+            throw std::out_of_range("Value of sleep ms is out of range");
+        }
+        mSleepMs = sleep_ms;
+        mPeriodChanged = true;
+    } else if (key == "suspend-after-event") {
+        mSuspendAfterEvent = parse_bool(value);
+    } else if (key == "poll-during-handlers") {
+        mPollDuringHandlers = parse_bool(value);
+    } else if (key == "verbose") {
+        int verbose = std::stoi(value);
+        if (verbose < 0) {
+            throw std::out_of_range("The value must not be negative");
+        }
+        mVerbose = verbose;
+    } else if (key == "gestures") {
+        if (value == "no") {
+            mGesturesEnabled = false;
+            mGestures.reset();
+            mBurst = false;
+            return;
+        }
+        std::vector<int> ms;
+        for (auto & item : split_list(value)) {
+            ms.push_back(std::stoi(item));
+            if (ms.back() < 0) {
+                throw std::out_of_range("The values must not be negative");
+            }
+        }
+        if (ms.size() != 3) {
+            throw std::invalid_argument("Expected three values or no");
+        }
+        gestures(ms[0], ms[1], ms[2]);
+    } else if (key == "pause-while") {
+        pause_while(split_list(value));
+    } else if (key == "handler-class") {
+        handler_class(value);
+    } else if (key.compare(0, 14, "handler-class.") == 0 && key.size() > 14) {
+        if (value.empty()) {
+            mEventClasses.erase(key.substr(14));
+            log("Handler of '" + key.substr(14) + "' runs with the default class", 1);
+            return;
+        }
+        ResourceClass limits(value);
+        limits.prepare();
+        mEventClasses[key.substr(14)] = limits;
+        log("Handler of '" + key.substr(14) + "' runs with " + (limits.empty() ? std::string("no limits") : limits.spec()), 1);
+    } else if (key == "ignore") {
+        auto names = split_list(value);
+        mIgnored = std::set<std::string>(names.begin(), names.end());
+    } else {
+        throw InsaneException("Unknown setting '" + key + "'");
+    }
+}
+
+
+std::string InsaneDaemon::setting(const std::string & key) const
+{
+    auto join = [](const std::vector<std::string> & items) {
+        std::string text;
+        for (auto & item : items) {
+            text += (text.empty() ? "" : ",") + item;
+        }
+        return text;
+    };
+    if (key == "events-dir") {
+        return mEventsDir;
+    } else if (key == "sleep-ms") {
+        return std::to_string(mSleepMs);
+    } else if (key == "suspend-after-event") {
+        return mSuspendAfterEvent ? "yes" : "no";
+    } else if (key == "poll-during-handlers") {
+        return mPollDuringHandlers ? "yes" : "no";
+    } else if (key == "verbose") {
+        return std::to_string(mVerbose);
+    } else if (key == "gestures") {
+        return mGesturesEnabled ? mGestures.thresholds() : "no";
+    } else if (key == "pause-while") {
+        return join(mWatcher.names());
+    } else if (key == "handler-class") {
+        return mHandlerClass.spec();
+    } else if (key.compare(0, 14, "handler-class.") == 0 && key.size() > 14) {
+        // empty if the handler runs with the default class
+        auto it = mEventClasses.find(key.substr(14));
+        return it != mEventClasses.end() ? it->second.spec() : "";
+    } else if (key == "ignore") {
+        return join(std::vector<std::string>(mIgnored.begin(), mIgnored.end()));
+    }
+    throw InsaneException("Unknown setting '" + key + "'");
+}
+
+
+void InsaneDaemon::reload_config() noexcept
+{
+    if (mConfigPath.empty()) {
+        log("No configuration file given, fetching sensors again", 1);
+        mRestartPoller = true;
+        return;
+    }
+    try {
+        Timer t;
+        auto config = read_config(mConfigPath);
+        std::string changed;
+        for (auto & entry : config) {
+            auto it = mConfig.find(entry.first);
+            if (it != mConfig.end() && it->second == entry.second) {
+                continue;
+            }
+            try {
+                if (!mBaseline.count(entry.first)) {
+                    mBaseline[entry.first] = setting(entry.first);
+                }
+                apply_setting(entry.first, entry.second);
+                mConfig[entry.first] = entry.second;
+                changed += (changed.empty() ? "" : ", ") + entry.first + " = " + entry.second;
+            } catch (InsaneException & e) {
+                log("Could not apply '" + entry.first + " = " + entry.second + "', keeping the previous value: " + e.what(), 0);
+            } catch (std::exception & e) {
+                log("Could not apply '" + entry.first + " = " + entry.second + "', keeping the previous value: " + e.what(), 0);
+            }
+        }
+        for (auto it = mConfig.begin(); it != mConfig.end(); ) {
+            if (config.find(it->first) != config.end()) {
+                ++it;
+                continue;
+            }
+            // back to the command line or default value
+            std::string value = mBaseline[it->first];
+            try {
+                apply_setting(it->first, value);
+                mBaseline.erase(it->first);
+                changed += (changed.empty() ? "" : ", ") + it->first + (value.empty() ? std::string() : " = " + value) + " (removed)";
+                it = mConfig.erase(it);
+            } catch (InsaneException & e) {
+                log("Could not restore '" + it->first + " = " + value + "', keeping the current value: " + e.what(), 0);
+                ++it;
+            } catch (std::exception & e) {
+                log("Could not restore '" + it->first + " = " + value + "', keeping the current value: " + e.what(), 0);
+                ++it;
+            }
+        }
+        long long us = t.restart_us();
+        log("Reloaded '" + mConfigPath + "' in " + std::to_string(us) + " us, "
+            + (changed.empty() ? std::string("nothing changed") : "changed: " + changed), 1);
+    } catch (InsaneException & e) {
+        log(std::string(e.what()) + ", keeping the running configuration", 0);
+    } catch (std::exception & e) {
+        log(std::string(e.what()) + ", keeping the running configuration", 0);
+    }
+}
+
+
+void InsaneDaemon::isolate_poller(int deadline_ms)
+{
+    if (deadline_ms <= 0) {
+        throw std::out_of_range("Value of poll deadline is out of range");
+    }
+    mIsolated = true;
+    mPollDeadlineMs = deadline_ms;
+    mPoller.set_functions([this]() {
+        // the child never execs, so it would keep event subscribers and the wake pipes open
+        mServer.close_inherited();
+        for (int fd : {mQueuePipe[0], mQueuePipe[1], mPollerPipe[0], mPollerPipe[1]}) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    }, [this]() {
+        return poll();
+    }, [this]() {
+        close();
+        if (mSaneInitialized) {
+            mSane.exit();
+        }
+    });
+}
+
+
+void InsaneDaemon::trace(const std::string & trace_file)
+{
+    TraceLog::open(trace_file);
+    log("Writing Chrome trace events to '" + trace_file + "'", 1);
+}
+
+
+void InsaneDaemon::record(const std::string & trace_file)
+{
+    mTrace.open_write(trace_file, mSleepMs);
+    log("Recording sensor trace to '" + trace_file + "'", 1);
+}
+
+
+void InsaneDaemon::replay(const std::string & trace_file, std::ostream & out)
+{
+    SensorTrace trace;
+    trace.open_read(trace_file);
+    if (trace.period_ms() > 1) {
+        // only reported, the samples carry their own time
+        mSleepMs = trace.period_ms();
+    }
+    mDryRun = true;
+    mSkipUntilUs.clear();
+
+    // time of the first sample where a sensor read on after being off
+    std::map<std::string, long long> press_start;
+    // sensors are not read until then, like after a busy device or with --suspend-after-event
+    long long suspend_until_us = 0;
+    long delayed = 0;
+    long long first_us = -1;
+    long long last_us = 0;
+    long long dispatch_us = 0;
+    long samples = 0;
+    long failed = 0;
+    long dispatched = 0;
+    long skipped = 0;
+    long long latency_sum_us = 0;
+    long long latency_max_us = 0;
+
+    out << "Replaying '" << trace_file << "', recorded every " << mSleepMs << " ms" << std::endl
+        << std::fixed << std::setprecision(1)
+        << std::setw(12) << "time [ms]" << "  " << std::left << std::setw(16) << "event" << std::setw(10) << "decision"
+        << std::right << std::setw(14) << "latency [ms]" << std::endl;
+
+    SensorSample sample;
+    while (trace.read(sample)) {
+        if (first_us < 0) {
+            first_us = sample.time_us;
+        }
+        last_us = sample.time_us;
+        samples++;
+        if (sample.status != SANE_STATUS_GOOD) {
+            failed++;
+            out << std::setw(12) << (sample.time_us - first_us) / 1000.0 << "  poll failed: " << sane_strstatus(sample.status) << std::endl;
+        }
+
+        // the daemon would not have read the sensors while suspended
+        bool suspended = sample.time_us < suspend_until_us;
+        std::vector<std::string> events;
+        if (!suspended) {
+            long long start_us = Timer::monotonic_us();
+            events = dispatch(sample);
+            dispatch_us += Timer::monotonic_us() - start_us;
+        }
+        if (sample.status == SANE_STATUS_DEVICE_BUSY || (mSuspendAfterEvent && !events.empty())) {
+            suspend_until_us = sample.time_us + BUSY_TIMEOUT_MS * 1000LL;
+        }
+
+        if (mGesturesEnabled) {
+            // gestures are only recognized after the buttons were released or held long enough
+            for (auto & event : events) {
+                dispatched++;
+                out << std::setw(12) << (sample.time_us - first_us) / 1000.0 << "  " << std::left << std::setw(16) << event
+                    << std::setw(10) << "dispatch" << std::right << std::endl;
+            }
+            continue;
+        }
+        for (auto & change : sample.changes) {
+            if (std::find(events.begin(), events.end(), change.first) != events.end()) {
+                dispatched++;
+                out << std::setw(12) << (sample.time_us - first_us) / 1000.0 << "  " << std::left << std::setw(16)
+                    << change.first + "=" + change.second << std::setw(10) << "dispatch" << std::right << std::endl;
+            }
+        }
+        for (auto & sensor : sample.sensors) {
+            if (!sensor.second) {
+                press_start.erase(sensor.first);
+                continue;
+            }
+            if (press_start.find(sensor.first) == press_start.end()) {
+                press_start[sensor.first] = sample.time_us;
+            }
+            bool fired = false;
+            for (auto & event : events) {
+                fired = fired || event == sensor.first;
+            }
+            // includes the time the press was skipped by debouncing or suspension
+            long long latency_us = sample.time_us - press_start[sensor.first];
+            out << std::setw(12) << (sample.time_us - first_us) / 1000.0 << "  " << std::left << std::setw(16) << sensor.first
+                << std::setw(10) << (fired ? "dispatch" : suspended ? "suspended" : "skip") << std::right;
+            if (fired) {
+                dispatched++;
+                if (latency_us > 0) {
+                    delayed++;
+                }
+                latency_sum_us += latency_us;
+                latency_max_us = std::max(latency_max_us, latency_us);
+                out << std::setw(14) << latency_us / 1000.0;
+            } else {
+                skipped++;
+            }
+            out << std::endl;
+        }
+    }
+    mDryRun = false;
+
+    out << "Samples: " << samples << " (" << failed << " failed), trace duration: " << (last_us - first_us) / 1000.0 << " ms" << std::endl
+        << "Events: " << dispatched << " dispatched, " << skipped << " skipped" << std::endl;
+    if (dispatched > 0 && !mGesturesEnabled) {
+        out << "Latency since the first sample of a press: avg " << latency_sum_us / dispatched / 1000.0 << " ms, max "
+            << latency_max_us / 1000.0 << " ms, " << delayed << " of " << dispatched << " events delayed" << std::endl;
+    }
+    if (samples > 0) {
+        out << "Processing time: " << dispatch_us / 1000.0 << " ms total, " << static_cast<double>(dispatch_us) / samples << " us per sample" << std::endl;
+    }
 }
 
 
-InsaneDaemon::InsaneDaemon()
+void InsaneDaemon::benchmark(int polls, std::ostream & out)
 {
-    log("Initializing...", 1);
-    Timer t;
-    if (!checkStatus(sane_init(&mVersionCode, nullptr), "sane_init")) {
-        log("error, failed to initialize SANE library!", 0);
+    if (mCurrentDevice.empty()) {
+        set_current_device(get_devices().at(0));
+    }
+    out << "Benchmarking '" << mCurrentDevice << "' with " << polls << " polls per strategy..." << std::endl;
+    mTimings.clear();
+    mBenchmarking = true;
+    std::vector<long long> reopen;
+    std::vector<long long> held;
+    size_t options = 0;
+    try {
+        // what the daemon does: open, read all sensors, close
+        mSensors.clear();
+        for (int i = 0; i < polls; ++i) {
+            Timer t;
+            options = get_sensors().size();
+            reopen.push_back(t.restart_us());
+        }
+        // keep the handle open between polls
+        OpenGuard g(mCurrentDevice);
+        for (int i = 0; i < polls; ++i) {
+            Timer t;
+            for (auto & entry : mSensors) {
+                fetch_sensor_value(entry.second);
+            }
+            held.push_back(t.restart_us());
+        }
+        // finding the sensors is only done once per device, but can be slow
+        for (int i = 0; i < polls; ++i) {
+            mSensors.clear();
+            fetch_sensors();
+        }
+    } catch (...) {
+        mBenchmarking = false;
+        throw;
+    }
+    mBenchmarking = false;
+    mTimings["poll, reopen per poll"] = reopen;
+    mTimings["poll, held handle"] = held;
+
+    out << std::left << std::setw(28) << "operation" << std::right << std::setw(8) << "samples"
+        << std::setw(11) << "p50 [ms]" << std::setw(11) << "p90 [ms]" << std::setw(11) << "p99 [ms]" << std::setw(11) << "max [ms]" << std::endl
+        << std::fixed << std::setprecision(3);
+    for (const char * name : {"sane_open", "fetch_sensors"}) {
+        print_timing(name, out);
+    }
+    for (auto & entry : mTimings) {
+        if (entry.first.compare(0, 5, "read ") == 0) {
+            print_timing(entry.first, out);
+        }
+    }
+    for (const char * name : {"sane_close", "poll, reopen per poll", "poll, held handle"}) {
+        print_timing(name, out);
     }
-    log("timer: sane_init: " + std::to_string(t.restart()) + " ms", 2);
 
-#ifdef SIGHUP
-    signal (SIGHUP, InsaneDaemon::sighandler);
-#endif
-#ifdef SIGPIPE
-    signal (SIGPIPE, InsaneDaemon::sighandler);
-#endif
-    signal (SIGINT, InsaneDaemon::sighandler);
-    signal (SIGTERM, InsaneDaemon::sighandler);
+    std::sort(reopen.begin(), reopen.end());
+    std::sort(held.begin(), held.end());
+    // leave the device idle at least half of the time even for slow polls
+    long safe_ms = static_cast<long>(2 * percentile_ms(reopen, 0.99) / 10 + 1) * 10;
+    safe_ms = std::max<long>(safe_ms, 50);
+    out << std::setprecision(2) << std::endl
+        << "SANE calls per poll: " << options + 2 << " (sane_open, " << options << " option reads, sane_close), "
+        << options << " with a held handle" << std::endl
+        << "Minimum safe interval: --sleep-ms=" << safe_ms << " (twice the 99th percentile of a poll)";
+    if (safe_ms > 5000) {
+        out << ", which is above the maximum of 5000 ms, polling this device is not recommended";
+    }
+    out << std::endl
+        << "Bus load at --sleep-ms=" << mSleepMs << ": device busy " << 100 * percentile_ms(reopen, 0.5) / mSleepMs << "% of the time, "
+        << (options + 2) * 1000.0 / mSleepMs << " SANE calls/s; with a held handle: "
+        << 100 * percentile_ms(held, 0.5) / mSleepMs << "%, " << options * 1000.0 / mSleepMs << " SANE calls/s" << std::endl;
 }
 
 
-InsaneDaemon::~InsaneDaemon() noexcept
+SensorSample InsaneDaemon::poll() noexcept
 {
-    log("Exiting...", 1);
-    close();
+    SensorSample sample;
+    sample.time_us = Timer::monotonic_us();
+    mLastStatus = SANE_STATUS_GOOD;
+    mOpenFailed = false;
+    INSANE_PROBE(poll_start);
+    INSANE_TRACE_BEGIN("poll", mCurrentDevice);
     try {
-        mHandle = nullptr;
-        log("Calling sane_exit", 1);
-        sane_exit();
+        sample.sensors = get_sensors(&sample.changes);
+    } catch (InsaneException & e) {
+        log(e.what(), 1);
+        sample.sensors.clear();
+        sample.changes.clear();
+        sample.status = mLastStatus != SANE_STATUS_GOOD ? mLastStatus : SANE_STATUS_INVAL;
+    } catch (std::exception & e) {
+        log(e.what(), 1);
+        sample.sensors.clear();
+        sample.changes.clear();
+        sample.status = mLastStatus != SANE_STATUS_GOOD ? mLastStatus : SANE_STATUS_INVAL;
+    }
+    sample.device = mCurrentDevice;
+    sample.open_failed = mOpenFailed;
+    INSANE_PROBE1(poll_end, static_cast<int>(sample.status));
+    INSANE_TRACE_END("poll", sane_strstatus(sample.status));
+    return sample;
+}
 
-        ::close(0);
-        ::close(1);
-        ::close(2);
 
-        log("Finished", 1);
-    } catch (...) {
-        log("Error calling sane_exit!", 0);
+SensorSample InsaneDaemon::poll_isolated() noexcept
+{
+    SensorSample sample;
+    std::string error;
+    bool ok = false;
+    INSANE_TRACE_BEGIN("poll_isolated", std::to_string(mPoller.pid()));
+    try {
+        ok = mPoller.poll(sample, mPollDeadlineMs, error);
+    } catch (std::exception & e) {
+        error = e.what();
     }
+    return isolated_result(ok, sample, error);
 }
 
 
-void InsaneDaemon::init(std::string device_name, std::string events_dir, int sleep_ms, int verbose, bool log_to_syslog, bool suspend_after_event)
+SensorSample InsaneDaemon::isolated_result(bool ok, SensorSample sample, const std::string & error) noexcept
 {
-    mCurrentDevice = device_name;
-    mEventsDir = events_dir;
-    mSleepMs = sleep_ms;
-    if (mSleepMs <= 1) {
-        throw std::out_of_range("Value of sleep ms is out of range");
+    if (ok) {
+        if (!sample.device.empty()) {
+            set_current_device(sample.device);
+        }
+        INSANE_TRACE_END("poll_isolated", sane_strstatus(sample.status));
+        return sample;
     }
-    mVerbose = verbose;
-    mLogToSyslog = log_to_syslog;
-    mSuspendAfterEvent = suspend_after_event;
+    INSANE_TRACE_END("poll_isolated", error);
+    log(error + ", will restart it", 0);
+    sample = SensorSample();
+    sample.time_us = Timer::monotonic_us();
+    sample.status = SANE_STATUS_IO_ERROR;
+    sample.device = current_device();
+    return sample;
 }
 
 
-void InsaneDaemon::open(std::string device_name)
+void InsaneDaemon::update_health(const SensorSample & sample) noexcept
 {
-    close();
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+    long long now_us = Timer::monotonic_us();
+    if (sample.status == SANE_STATUS_GOOD) {
+        int failures = mHealth.failures();
+        if (mHealth.success(now_us)) {
+            log("Device '" + mCurrentDevice + "' is " + DeviceHealth::state_name(mHealth.state())
+                + " again after " + std::to_string(failures) + " failed polls", 1);
+        }
+        return;
+    }
+    bool changed = mHealth.failure(sample.status, sample.open_failed, now_us);
+    if (changed || mHealth.failures() % 10 == 0) {
+        log("Device '" + mCurrentDevice + "' is " + DeviceHealth::state_name(mHealth.state()) + " after "
+            + std::to_string(mHealth.failures()) + " failed polls, next attempt in "
+            + std::to_string(mHealth.next_poll_ms(now_us)) + " ms", 1);
+    }
+}
 
-    Timer t;
-    if (device_name.empty())
+
+void InsaneDaemon::log_stats(int verbosity) noexcept
+{
+    long long now_us = Timer::monotonic_us();
     {
-        /* If no device name was specified explicitly, we look at the
-           environment variable SANE_DEFAULT_DEVICE.  If this variable
-           is not set, we open the first device we find (if any): */
-        const char * defname = getenv("SANE_DEFAULT_DEVICE");
-        if (defname != nullptr) {
-            device_name = std::string(defname);
-        } else {
-            device_name = get_devices().at(0);
+        // the poller thread updates these
+        std::lock_guard<std::mutex> lock(mStatsMutex);
+        std::string states;
+        for (int i = 0; i < DeviceHealth::STATE_COUNT; ++i) {
+            auto state = static_cast<DeviceHealth::State>(i);
+            states += std::string(i ? ", " : "") + DeviceHealth::state_name(state) + " "
+                + std::to_string(mHealth.time_in_state_ms(state, now_us)) + " ms";
+        }
+        log("stats: device '" + current_device() + "' is " + DeviceHealth::state_name(mHealth.state())
+            + ", time per state: " + states, verbosity);
+        if (mTimedPolls > 0) {
+            log("stats: polls started " + std::to_string(mPollLateSumUs / mTimedPolls) + " us late on average, max "
+                + std::to_string(mPollLateMaxUs) + " us, " + std::to_string(mLatePolls) + " of " + std::to_string(mTimedPolls)
+                + " more than " + std::to_string(LATE_POLL_MS) + " ms late", verbosity);
         }
     }
-    log("Opening device '" + device_name + "'", 2);
-    mCurrentDevice = device_name;
-
-    if (!checkStatus(sane_open(device_name.c_str(), &mHandle), "opening device '" + device_name + "'")) {
-        if (device_name[0] == '/') {
-            std::cerr << "\nYou seem to have specified a UNIX device name, or filename instead of selecting\n"
-                         "the SANE scanner or image acquisition device you want to use. As an example,\n"
-                         "you might want \"epson:/dev/sg0\" or \"hp:/dev/usbscanner0\". If any supported\n"
-                         "devices are installed in your system, you should be able to see a list with\n"
-                         "\"scanimage --list-devices\"." << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(mQuarantineMutex);
+        if (mQuarantine.quarantines() > 0) {
+            std::string summary = mQuarantine.summary(now_us);
+            log("stats: " + std::to_string(mQuarantine.quarantines()) + " sensor quarantines, "
+                + (summary.empty() ? std::string("none active") : "active: " + summary), verbosity);
         }
-        throw InsaneException("Failed to open device '" + device_name + "'");
     }
-    log("timer: sane_open: " + std::to_string(t.restart()) + " ms", 2);
+    if (mIsolated) {
+        log("stats: poller process " + std::to_string(mPoller.pid()) + ", "
+            + std::to_string(mPoller.failures()) + " restarts", verbosity);
+    }
+    if (mPowerSave) {
+        double seconds = std::max(1LL, now_us - mPowerStartUs) / 1e6;
+        std::string suspended = "unknown";
+        long long suspended_ms = mUsb.suspended_time_ms();
+        if (suspended_ms >= 0 && mSuspendedStartMs >= 0) {
+            suspended_ms -= mSuspendedStartMs;
+            suspended = std::to_string(suspended_ms) + " ms ("
+                + std::to_string(static_cast<int>(suspended_ms / 10.0 / seconds)) + "%), now " + mUsb.runtime_status();
+        }
+        char rates[64];
+        snprintf(rates, sizeof(rates), "%.2f wakeups/s, %.2f polls/s", mWakeups / seconds, mPolls / seconds);
+        log(std::string("stats: ") + rates + ", device suspended " + suspended, verbosity);
+    }
+    if (mProxyPort > 0) {
+        log("stats: " + std::to_string(mProxy.sessions()) + " SANE net sessions", verbosity);
+    }
+    if (mServer.is_open()) {
+        log("stats: " + std::to_string(mServer.clients()) + " event subscribers, "
+            + std::to_string(mServer.dropped()) + " dropped", verbosity);
+    }
+    if (mThreaded) {
+        long popped = mQueuePopped;
+        log("stats: queue depth " + std::to_string(mQueue.size()) + " (max " + std::to_string(mQueueMaxDepth) + " of "
+            + std::to_string(mQueue.capacity()) + "), " + std::to_string(mQueueDrops) + " dropped, latency avg "
+            + std::to_string(popped ? mQueueLatencySumUs / popped : 0) + " us, max " + std::to_string(mQueueLatencyMaxUs)
+            + " us over " + std::to_string(popped) + " samples", verbosity);
+    }
 }
 
 
-void InsaneDaemon::close() noexcept
+void InsaneDaemon::wait_events(long long ms, int fd)
 {
-    try {
-        if (mHandle)
-        {
-            log("Closing device '" + mCurrentDevice + "'", 2);
-            Timer t;
-            sane_close(mHandle);
-            log("timer: sane_close: " + std::to_string(t.restart()) + " ms", 2);
-
-        }
-    } catch (...) {
-        log("Error closing device!", 0);
+    if (!mServer.is_open()) {
+        sleep_ms(ms, fd);
+        return;
     }
-    mHandle = nullptr;
+    auto fds = mServer.poll_fds();
+    if (fd >= 0) {
+        fds.push_back(pollfd{fd, POLLIN, 0});
+    }
+    ::poll(fds.data(), fds.size(), static_cast<int>(ms));
+    mServer.update();
 }
 
 
-void InsaneDaemon::run()
+void InsaneDaemon::sleep_ms(long long ms, int fd) noexcept
 {
-    mRun = true;
-    {
-        // try to open the device to select one if no device was given
-        OpenGuard g(mCurrentDevice);
+    if (fd >= 0) {
+        pollfd pfd = {fd, POLLIN, 0};
+        ::poll(&pfd, 1, static_cast<int>(ms));
+        return;
     }
+    timespec delay;
+    delay.tv_sec = static_cast<time_t>(ms / 1000);
+    delay.tv_nsec = static_cast<long>(ms % 1000) * 1000000;
+    // returns early when interrupted by a signal, so the main loop reacts to it immediately
+    nanosleep(&delay, nullptr);
+}
 
-    log("Starting polling sensors of " + mCurrentDevice + " every " + std::to_string(mSleepMs) + " ms", 1);
-    while (mRun) {
-        if (mSuspendCount <= 0) {
-            // TODO skip reading sensors if
-            // - some process (e.g. xsane, screensaver, screenlocker) is running
-            // - some file (e.g. libsane) is opened by another process
-            log("Reading sensors...", 2);
-            try {
-                auto sensors = get_sensors();
-                for (auto & sensor : sensors) {
-                    if (mRepeatCount.find(sensor.first) != mRepeatCount.end()) {
-                        mRepeatCount[sensor.first]--;
-                    }
-                    if (sensor.second) {
-                        process_event(sensor.first);
-                    }
-                }
-            } catch (InsaneException & e) {
-                log(e.what(), 1);
+
+std::vector<std::string> InsaneDaemon::dispatch(const SensorSample & sample)
+{
+    std::vector<std::string> events;
+    mSampleTimeUs = sample.time_us;
+    mSampleDevice = sample.device;
+    for (auto it = mSkipUntilUs.begin(); it != mSkipUntilUs.end(); ) {
+        // events are not skipped any more once their deadline passed, however often the sensors are read
+        if (it->second <= mSampleTimeUs) {
+            it = mSkipUntilUs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    std::unique_lock<std::mutex> lock(mQuarantineMutex);
+    for (auto & name : mQuarantine.feed(sample.time_us, sample.sensors, sample.changes)) {
+        auto state = mQuarantine.state(name);
+        if (state != SensorQuarantine::NORMAL) {
+            log("Sensor '" + name + "' is " + SensorQuarantine::state_name(state)
+                + ", its events are suppressed until it reads normally again", 0);
+        } else {
+            log("Sensor '" + name + "' reads normally again", 0);
+        }
+    }
+    const SensorSample::Sensors * sensors = &sample.sensors;
+    SensorSample::Sensors filtered;
+    if (mQuarantine.any() || !mIgnored.empty()) {
+        // quarantined and ignored buttons are left out, a release would complete a press in progress
+        for (auto & sensor : sample.sensors) {
+            if (mQuarantine.state(sensor.first) != SensorQuarantine::NORMAL
+                    || mIgnored.find(sensor.first) != mIgnored.end()) {
+                mGestures.forget(sensor.first);
+            } else {
+                filtered.push_back(sensor);
             }
+        }
+        sensors = &filtered;
+    }
+    std::vector<const SensorSample::Changes::value_type *> changed;
+    for (auto & change : sample.changes) {
+        // the first value seen is not a change
+        auto it = mValues.find(change.first);
+        bool is_change = it != mValues.end() && it->second != change.second;
+        mValues[change.first] = change.second;
+        if (is_change && mQuarantine.state(change.first) != SensorQuarantine::NORMAL) {
+            log("Skipping event '" + change.first + "' of a quarantined sensor", 2);
+        } else if (is_change && mIgnored.find(change.first) != mIgnored.end()) {
+            log("Skipping event '" + change.first + "' of an ignored sensor", 2);
+        } else if (is_change) {
+            changed.push_back(&change);
         } else {
-            log("Reading sensors is suspended: " + std::to_string(mSuspendCount) + " events left", 2);
-            mSuspendCount--;
+            log("Sensor '" + change.first + "' is '" + change.second + "'", 2);
         }
-
-        usleep(mSleepMs * 1000);
     }
+    // handlers are forked below, not while the poller thread may wait for the lock
+    lock.unlock();
+    for (auto change : changed) {
+        if (process_event(change->first, &change->second)) {
+            events.push_back(change->first);
+        }
+    }
+    if (mGesturesEnabled) {
+        for (auto & gesture : mGestures.feed(sample.time_us, *sensors)) {
+            if (process_event(gesture)) {
+                events.push_back(gesture);
+            }
+        }
+        return events;
+    }
+    for (auto & sensor : *sensors) {
+        if (sensor.second && process_event(sensor.first)) {
+            events.push_back(sensor.first);
+        }
+    }
+    return events;
 }
 
 
-void InsaneDaemon::process_event(std::string name)
+bool InsaneDaemon::process_event(std::string name, const std::string * value)
 {
-    if (mRepeatCount.find(name) != mRepeatCount.end()) {
-        int count = mRepeatCount[name];
-        if (count > 0) {
-            log("Skipping event '" + name + "', will wait for " + std::to_string(count) + " more periods", 2);
-            return;
+    if (value) {
+        log("Processing event '" + name + "', new value '" + *value + "'", 1);
+        if (mDryRun) {
+            return true;
         }
+        mServer.publish(mSampleDevice, name, *value);
+        run_handler(name, value);
+        return true;
+    }
+    auto skip = mSkipUntilUs.find(name);
+    if (skip != mSkipUntilUs.end() && skip->second > mSampleTimeUs) {
+        log("Skipping event '" + name + "', will wait for " + std::to_string((skip->second - mSampleTimeUs) / 1000)
+            + " more ms", 2);
+        INSANE_PROBE2(debounce, name.c_str(), 0);
+        INSANE_TRACE_INSTANT("debounce", name + ": skip");
+        return false;
+    }
+    // only a full table of the lean build has no room, then the event is not debounced
+    if (mSkipUntilUs.size() < mSkipUntilUs.max_size()) {
+        mSkipUntilUs[name] = mSampleTimeUs + SKIP_TIMEOUT_MS * 1000LL;
     }
-    mRepeatCount[name] = SKIP_TIMEOUT_MS / mSleepMs;
+    INSANE_PROBE2(debounce, name.c_str(), 1);
+    INSANE_TRACE_INSTANT("debounce", name + ": dispatch");
 
     log("Processing event '" + name + "'", 1);
+    if (mDryRun) {
+        return true;
+    }
+    mServer.publish(mSampleDevice, name);
+    run_handler(name, nullptr);
+    return true;
+}
+
+
+void InsaneDaemon::run_handler(const std::string & name, const std::string * value)
+{
     std::string handler = mEventsDir + "/" + name;
     struct stat f;
     if (stat(handler.c_str(), &f) < 0) {
-        std::string err = strerror(errno);
-        if (errno == ENOENT || errno == ENOTDIR) {
+        int error = errno;
+        std::string err = strerror(error);
+        mJournal.append(EventJournal::NO_HANDLER, mSampleDevice, name, error, 0, 0);
+        if (error == ENOENT || error == ENOTDIR) {
             log("script handler '" + handler + "' does not exist, please create an empty executable "
                 "file to silence this warning, error: " + err, 0);
             return;
@@ -202,36 +1705,122 @@ void InsaneDaemon::process_event(std::string name)
     if (S_ISREG((f.st_mode))) {
         if (!((f.st_mode & S_IXUSR) | (f.st_mode & S_IXGRP) | (f.st_mode & S_IXOTH))) {
             log("warning, script handler '" + handler + "' is not executable", 0);
+            mJournal.append(EventJournal::NO_HANDLER, mSampleDevice, name, EACCES, 0, 0);
             return;
         } else {
             if (f.st_size == 0) {
                 // ignore
+                mJournal.append(EventJournal::NO_HANDLER, mSampleDevice, name, 0, 0, 0);
                 return;
             }
         }
-        log("calling event handler script '" + handler + "'", 2);
-        if (system((handler + " " + mCurrentDevice).c_str()) < 0) {
-            std::string err = strerror(errno);
-            log("Failed to execute script handler '" + handler + "': " + err, 0);
-            return;
-        } else if (mSuspendAfterEvent) {
-            mSuspendCount = BUSY_TIMEOUT_MS / mSleepMs;
-        }
+        spawn_handler(name, handler, value);
     } else {
         log("warning, script handler '" + handler + "' is not a regular file", 0);
+        mJournal.append(EventJournal::NO_HANDLER, mSampleDevice, name, EISDIR, 0, 0);
+    }
+}
+
+
+void InsaneDaemon::spawn_handler(const std::string & name, const std::string & handler, const std::string * value)
+{
+    log("calling event handler script '" + handler + "'", 2);
+    INSANE_PROBE1(handler_spawn, name.c_str());
+    long long start_us = Timer::monotonic_us();
+    std::string net_device = mProxyPort > 0 ? "net:localhost:" + mSampleDevice : "";
+    auto it = mEventClasses.find(name);
+    const ResourceClass & limits = it != mEventClasses.end() ? it->second : mHandlerClass;
+    // the child of a multithreaded process may only call async-signal-safe functions,
+    // so everything exec needs is allocated before the fork
+    std::vector<const char *> args = {"sh", handler.c_str(), mSampleDevice.c_str()};
+    if (value) {
+        args.push_back(value->c_str());
+    }
+    args.push_back(nullptr);
+    std::string default_device = "SANE_DEFAULT_DEVICE=" + net_device;
+    std::vector<const char *> env;
+    for (char ** var = environ; *var; ++var) {
+        if (net_device.empty() || strncmp(*var, "SANE_DEFAULT_DEVICE=", 20) != 0) {
+            env.push_back(*var);
+        }
+    }
+    if (!net_device.empty()) {
+        // scanimage and most frontends use it when no device is given
+        env.push_back(default_device.c_str());
+    }
+    env.push_back(nullptr);
+    char * const * argv = const_cast<char * const *>(args.data());
+    char * const * envp = const_cast<char * const *>(env.data());
+    pid_t pid = fork();
+    if (pid == 0) {
+        // inherited by everything the handler starts
+        limits.apply();
+        execve(handler.c_str(), argv + 1, envp);
+        if (errno == ENOEXEC) {
+            // script without #! line, run it with the shell like system() would
+            execve("/bin/sh", argv, envp);
+        }
+        _exit(127);
+    }
+    if (pid < 0) {
+        std::string err = strerror(errno);
+        log("Failed to execute script handler '" + handler + "': " + err, 0);
+        INSANE_TRACE_INSTANT("handler", handler + ": " + err);
         return;
     }
+    // handlers overlap and finish in any order, so they are not nested begin/end events
+    INSANE_TRACE_ASYNC_BEGIN("handler", pid, handler);
+    mHandlers[pid] = Handler{name, handler, mSampleDevice, start_us};
+    mJournal.append(EventJournal::DISPATCHED, mSampleDevice, name, 0, pid, start_us - mSampleTimeUs);
+}
+
+
+void InsaneDaemon::reap_handlers() noexcept
+{
+    for (auto it = mHandlers.begin(); it != mHandlers.end(); ) {
+        int status = 0;
+        pid_t pid = waitpid(it->first, &status, WNOHANG);
+        if (pid == 0 || (pid < 0 && errno == EINTR)) {
+            ++it;
+            continue;
+        }
+        long long runtime_us = Timer::monotonic_us() - it->second.start_us;
+        INSANE_PROBE2(handler_exit, it->second.name.c_str(), status);
+        int error = errno;
+        INSANE_TRACE_ASYNC_END("handler", it->first, std::to_string(status));
+        errno = error;
+        if (pid < 0) {
+            log("Lost event handler script '" + it->second.handler + "': " + strerror(errno), 0);
+        } else {
+            log("event handler script '" + it->second.handler + "' finished with status " + std::to_string(status)
+                + " after " + std::to_string(runtime_us / 1000) + " ms", 2);
+            mJournal.append(EventJournal::HANDLER_EXIT, it->second.device, it->second.name, status, pid, runtime_us);
+            if (mSuspendAfterEvent) {
+                mSuspendUntilUs = Timer::monotonic_us() + BUSY_TIMEOUT_MS * 1000LL;
+            }
+        }
+        it = mHandlers.erase(it);
+    }
 }
 
 
-std::string InsaneDaemon::current_device() noexcept
+std::string InsaneDaemon::current_device() const noexcept
 {
+    std::lock_guard<std::mutex> lock(mDeviceMutex);
     return mCurrentDevice;
 }
 
 
+void InsaneDaemon::set_current_device(const std::string & device_name)
+{
+    std::lock_guard<std::mutex> lock(mDeviceMutex);
+    mCurrentDevice = device_name;
+}
+
+
 std::string InsaneDaemon::get_sane_version() noexcept
 {
+    init_sane();
     return std::to_string(SANE_VERSION_MAJOR(mVersionCode)) + "." + std::to_string(SANE_VERSION_MINOR(mVersionCode))
             + "." + std::to_string(SANE_VERSION_BUILD(mVersionCode));
 }
@@ -240,11 +1829,12 @@ std::string InsaneDaemon::get_sane_version() noexcept
 const std::vector<std::string> InsaneDaemon::get_devices()
 {
     if (mDevices.empty()) {
+        init_sane();
         log("Fetching device list...", 1);
         Timer t;
         const SANE_Device ** device_list;
 
-        if (!checkStatus(sane_get_devices(&device_list, SANE_FALSE), "sane_get_devices")) {
+        if (!checkStatus(mSane.get_devices(&device_list, SANE_FALSE), "sane_get_devices")) {
             throw InsaneException("Could not list SANE devices");
         }
         if (!device_list[0]) {
@@ -259,18 +1849,27 @@ const std::vector<std::string> InsaneDaemon::get_devices()
 }
 
 
-std::vector<std::pair<std::string, bool> > InsaneDaemon::get_sensors()
+std::vector<std::pair<std::string, bool> > InsaneDaemon::get_sensors(std::vector<std::pair<std::string, std::string> > * changes)
 {
     OpenGuard g(mCurrentDevice);
 
-    if (mSensors.empty()) {
+    if (mSensors.empty() && mValueSensors.empty()) {
         fetch_sensors();
+    } else if (mReloadOptions || mProxy.take_reload() || !sensors_valid()) {
+        // e.g. after a mode change or a firmware update
+        log("Options of '" + mCurrentDevice + "' have changed, updating sensors", 1);
+        mReloadOptions = false;
+        update_sensors();
     }
     Timer t;
     std::vector<std::pair<std::string, bool> > result;
     for (auto & entry : mSensors) {
         result.push_back(fetch_sensor_value(entry.second));
     }
+    if (!mValueSensors.empty()) {
+        std::vector<std::pair<std::string, std::string> > ignored;
+        fetch_sensor_values(changes ? *changes : ignored);
+    }
     log("timer: fetch all sensor values: " + std::to_string(t.restart()) + " ms", 2);
     return result;
 }
@@ -278,9 +1877,12 @@ std::vector<std::pair<std::string, bool> > InsaneDaemon::get_sensors()
 
 bool InsaneDaemon::checkStatus(SANE_Status status, const std::string & operation)
 {
+    if (status != SANE_STATUS_GOOD) {
+        mLastStatus = status;
+    }
     if (status == SANE_STATUS_DEVICE_BUSY) {
         log(operation + " returned status DEVICE BUSY", 1);
-        mSuspendCount = BUSY_TIMEOUT_MS / mSleepMs;
+        mSuspendUntilUs = Timer::monotonic_us() + BUSY_TIMEOUT_MS * 1000LL;
         return false;
     } else if (status == SANE_STATUS_GOOD) {
         return true;
@@ -298,14 +1900,15 @@ void InsaneDaemon::log(const std::string & message, int verbosity) noexcept
             if (mLogToSyslog) {
                 syslog((verbosity == 1 ? LOG_INFO : LOG_ERR) | LOG_USER, "%s: %s", InsaneDaemon::NAME.c_str(), message.c_str());
             } else {
-                std::cerr << InsaneDaemon::NAME << ": " << message << std::endl;
+                // stdio instead of iostream keeps logging small
+                fprintf(stderr, "%s: %s\n", InsaneDaemon::NAME.c_str(), message.c_str());
             }
         }
     } catch (...) {
         // try to log on stderr if syslog failed somehow
         try {
             if (mLogToSyslog) {
-                std::cerr << InsaneDaemon::NAME << ": " << message << std::endl;
+                fprintf(stderr, "%s: %s\n", InsaneDaemon::NAME.c_str(), message.c_str());
             } else {
                 // die
                 std::abort();
@@ -318,10 +1921,31 @@ void InsaneDaemon::log(const std::string & message, int verbosity) noexcept
 }
 
 
+void InsaneDaemon::timing(const char * name, const char * detail, long long us)
+{
+    if (mBenchmarking) {
+        mTimings[std::string(name) + detail].push_back(us);
+    }
+}
+
+
+void InsaneDaemon::print_timing(const std::string & name, std::ostream & out)
+{
+    std::vector<long long> & values = mTimings[name];
+    std::sort(values.begin(), values.end());
+    out << std::left << std::setw(28) << name << std::right << std::setw(8) << values.size()
+        << std::setw(11) << percentile_ms(values, 0.5) << std::setw(11) << percentile_ms(values, 0.9)
+        << std::setw(11) << percentile_ms(values, 0.99) << std::setw(11) << percentile_ms(values, 1.0) << std::endl;
+}
+
+
 bool InsaneDaemon::is_sensor_option(const SANE_Option_Descriptor * opt)
 {
+    // arrays are not supported
     return opt && opt->name
-        && opt->type == SANE_TYPE_BOOL
+        && (((opt->type == SANE_TYPE_BOOL || opt->type == SANE_TYPE_INT || opt->type == SANE_TYPE_FIXED)
+             && opt->size == sizeof(SANE_Word))
+            || (opt->type == SANE_TYPE_STRING && opt->size > 0))
         && opt->cap & SANE_CAP_HARD_SELECT
         && !(opt->cap & SANE_CAP_SOFT_SELECT)
         && opt->cap & SANE_CAP_SOFT_DETECT
@@ -333,38 +1957,59 @@ void InsaneDaemon::fetch_sensors()
 {
     assert(mHandle);
     Timer t;
-    const SANE_Option_Descriptor * opt = sane_get_option_descriptor(mHandle, 0);
+    const SANE_Option_Descriptor * opt = mSane.get_option_descriptor(mHandle, 0);
     if (opt == nullptr) {
         log("Could not get option descriptor for option 0", 0);
         throw InsaneException("Could not fetch device options");
     }
 
+    mValueSensors.clear();
+    mSnapshot.clear();
+    mSnapshotValid = false;
+
     SANE_Int num_dev_options = 0;
-    if (!checkStatus(sane_control_option(mHandle, 0, SANE_ACTION_GET_VALUE, &num_dev_options, 0), "Fetching value for option 0")) {
+    INSANE_PROBE1(control_option_start, 0);
+    INSANE_TRACE_BEGIN("sane_control_option", "0");
+    SANE_Status status = mSane.control_option(mHandle, 0, SANE_ACTION_GET_VALUE, &num_dev_options, 0);
+    INSANE_PROBE2(control_option_end, 0, static_cast<int>(status));
+    INSANE_TRACE_END("sane_control_option", sane_strstatus(status));
+    if (!checkStatus(status, "Fetching value for option 0")) {
         throw InsaneException("Could not fetch device options");
     }
 
     /* build the table of sensors */
     for (int i = 1; i < num_dev_options; ++i)
     {
-        opt = sane_get_option_descriptor(mHandle, i);
+        opt = mSane.get_option_descriptor(mHandle, i);
         if (opt == nullptr) {
             log("Could not get option descriptor for option " + std::to_string(i), 0);
             throw InsaneException("Could not fetch device options");
         }
 
         if (is_sensor_option(opt)) {
-            mSensors[std::string(opt->name)] = i;
+            if (opt->type == SANE_TYPE_BOOL && mSensors.size() >= mSensors.max_size()) {
+                log("warning, too many buttons, ignoring '" + std::string(opt->name) + "'", 0);
+            } else if (opt->type == SANE_TYPE_BOOL) {
+                mSensors[std::string(opt->name)] = i;
+            } else {
+                // keep words aligned
+                size_t offset = (mSnapshot.size() + sizeof(SANE_Word) - 1) / sizeof(SANE_Word) * sizeof(SANE_Word);
+                mValueSensors.push_back(ValueSensor{opt->name, i, opt->type, offset, static_cast<size_t>(opt->size)});
+                mSnapshot.resize(offset + static_cast<size_t>(opt->size));
+            }
         }
     }
-    log("timer: fetch_sensors: " + std::to_string(t.restart()) + " ms", 2);
+    mPrevSnapshot.assign(mSnapshot.size(), 0);
+    long long fetch_us = t.restart_us();
+    log("timer: fetch_sensors: " + std::to_string(fetch_us / 1000) + " ms", 2);
+    timing("fetch_sensors", "", fetch_us);
 }
 
 
 std::pair<std::string, bool> InsaneDaemon::fetch_sensor_value(int opt_num)
 {
     assert(mHandle);
-    const SANE_Option_Descriptor * opt = sane_get_option_descriptor(mHandle, opt_num);
+    const SANE_Option_Descriptor * opt = mSane.get_option_descriptor(mHandle, opt_num);
 
     if (!opt || opt->type == SANE_TYPE_GROUP) {
         throw InsaneException("Invalid option number: " + std::to_string(opt_num));
@@ -378,8 +2023,18 @@ std::pair<std::string, bool> InsaneDaemon::fetch_sensor_value(int opt_num)
         /* print current option value */
         if (opt->size == sizeof (SANE_Word)) {
             SANE_Word val;
-            if (!checkStatus(sane_control_option(mHandle, opt_num, SANE_ACTION_GET_VALUE, &val, 0),
-                             "Fetching value of option " + std::string(opt->name))) {
+            Timer t;
+            INSANE_PROBE1(control_option_start, opt_num);
+            INSANE_TRACE_BEGIN("sane_control_option", opt->name);
+            SANE_Int info = 0;
+            SANE_Status status = mSane.control_option(mHandle, opt_num, SANE_ACTION_GET_VALUE, &val, &info);
+            INSANE_PROBE2(control_option_end, opt_num, static_cast<int>(status));
+            INSANE_TRACE_END("sane_control_option", sane_strstatus(status));
+            timing("read ", opt->name, t.restart_us());
+            if (info & SANE_INFO_RELOAD_OPTIONS) {
+                mReloadOptions = true;
+            }
+            if (!checkStatus(status, "Fetching value of option " + std::string(opt->name))) {
                 throw InsaneException("Could not fetch value of option " + std::string(opt->name));
             }
             if (opt->type == SANE_TYPE_BOOL) {
@@ -395,18 +2050,164 @@ std::pair<std::string, bool> InsaneDaemon::fetch_sensor_value(int opt_num)
 }
 
 
+bool InsaneDaemon::sensors_valid()
+{
+    assert(mHandle);
+    // descriptors are kept by the backend, getting them does not access the device
+    for (auto & entry : mSensors) {
+        const SANE_Option_Descriptor * opt = mSane.get_option_descriptor(mHandle, entry.second);
+        if (!is_sensor_option(opt) || entry.first != opt->name || opt->type != SANE_TYPE_BOOL) {
+            return false;
+        }
+    }
+    for (auto & sensor : mValueSensors) {
+        const SANE_Option_Descriptor * opt = mSane.get_option_descriptor(mHandle, sensor.option);
+        if (!is_sensor_option(opt) || sensor.name != opt->name || opt->type != sensor.type
+                || static_cast<size_t>(opt->size) != sensor.size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void InsaneDaemon::update_sensors()
+{
+    SensorTable old_sensors;
+    std::vector<ValueSensor> old_values;
+    std::vector<char> old_snapshot;
+    old_sensors.swap(mSensors);
+    old_values.swap(mValueSensors);
+    old_snapshot.swap(mPrevSnapshot);
+    bool valid = mSnapshotValid;
+    fetch_sensors();
+
+    std::map<std::string, int> old_options;
+    for (auto & sensor : old_values) {
+        old_options[sensor.name] = sensor.option;
+    }
+    old_options.insert(old_sensors.begin(), old_sensors.end());
+    std::map<std::string, int> new_options(mSensors.begin(), mSensors.end());
+    for (auto & sensor : mValueSensors) {
+        new_options[sensor.name] = sensor.option;
+    }
+    for (auto & entry : old_options) {
+        auto it = new_options.find(entry.first);
+        if (it == new_options.end()) {
+            log("Sensor '" + entry.first + "' is gone", 1);
+        } else if (it->second != entry.second) {
+            log("Sensor '" + entry.first + "' has moved from option " + std::to_string(entry.second) + " to " + std::to_string(it->second), 2);
+        }
+    }
+    for (auto & entry : new_options) {
+        if (old_options.find(entry.first) == old_options.end()) {
+            log("Found new sensor '" + entry.first + "'", 1);
+        }
+    }
+
+    // unchanged sensors keep their previous value, so that they are not reported as changed
+    for (auto & sensor : mValueSensors) {
+        for (auto & old : old_values) {
+            if (valid && old.name == sensor.name && old.type == sensor.type && old.size == sensor.size) {
+                memcpy(&mPrevSnapshot[sensor.offset], &old_snapshot[old.offset], sensor.size);
+            }
+        }
+    }
+    mSnapshotValid = valid;
+}
+
+
+void InsaneDaemon::fetch_sensor_values(std::vector<std::pair<std::string, std::string> > & changes)
+{
+    assert(mHandle);
+    // backends do not have to clear string values after the terminating zero
+    std::fill(mSnapshot.begin(), mSnapshot.end(), 0);
+    for (auto & sensor : mValueSensors) {
+        char * value = &mSnapshot[sensor.offset];
+        Timer t;
+        INSANE_PROBE1(control_option_start, sensor.option);
+        INSANE_TRACE_BEGIN("sane_control_option", sensor.name);
+        SANE_Int info = 0;
+        SANE_Status status = mSane.control_option(mHandle, sensor.option, SANE_ACTION_GET_VALUE, value, &info);
+        INSANE_PROBE2(control_option_end, sensor.option, static_cast<int>(status));
+        INSANE_TRACE_END("sane_control_option", sane_strstatus(status));
+        timing("read ", sensor.name.c_str(), t.restart_us());
+        if (info & SANE_INFO_RELOAD_OPTIONS) {
+            mReloadOptions = true;
+        }
+        if (!checkStatus(status, "Fetching value of option " + sensor.name)) {
+            throw InsaneException("Could not fetch value of option " + sensor.name);
+        }
+        if (!mSnapshotValid || memcmp(value, &mPrevSnapshot[sensor.offset], sensor.size) != 0) {
+            changes.emplace_back(sensor.name, format_value(sensor, value));
+        }
+    }
+    mSnapshot.swap(mPrevSnapshot);
+    mSnapshotValid = true;
+}
+
+
+std::string InsaneDaemon::format_value(const ValueSensor & sensor, const char * value)
+{
+    SANE_Word word = 0;
+    switch (sensor.type) {
+    case SANE_TYPE_INT:
+        memcpy(&word, value, sizeof(word));
+        return std::to_string(word);
+    case SANE_TYPE_FIXED: {
+        memcpy(&word, value, sizeof(word));
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%g", SANE_UNFIX(word));
+        return buf;
+    }
+    default: {
+        std::string text(value, strnlen(value, sensor.size));
+        // the value is passed on in a single line
+        for (char & c : text) {
+            if (static_cast<unsigned char>(c) < 0x20) {
+                c = ' ';
+            }
+        }
+        return text;
+    }
+    }
+}
+
+
+void InsaneDaemon::log_signal() noexcept
+{
+    int signum = mLastSignal;
+    if (signum) {
+        mLastSignal = 0;
+        log("Received signal " + std::to_string(signum), 1);
+    }
+}
+
+
 void InsaneDaemon::sighandler(int signum)
 {
     static bool first_time = true;
     InsaneDaemon & daemon = InsaneDaemon::instance();
+#ifdef SIGCHLD
+    if (signum == SIGCHLD) {
+        // only wakes up the main loop to reap event handler scripts
+        return;
+    }
+#endif
 
-    daemon.log("Received signal " + std::to_string(signum), 1);
+    // logging here could re-enter stdio or malloc, the main loop logs the signal
+    daemon.mLastSignal = signum;
     switch (signum) {
+#ifdef SIGUSR1
+    case SIGUSR1:
+        daemon.mStatsRequested = true;
+        return;
+#endif
 #ifdef SIGHUP
     case SIGHUP:
-        daemon.mSensors.clear();
-        daemon.mDevices.clear();
-        break;
+        // the main loop reloads the configuration, the device is not disturbed
+        daemon.mReloadRequested = true;
+        return;
 #endif
 #ifdef SIGPIPE
     case SIGPIPE:
@@ -420,13 +2221,18 @@ void InsaneDaemon::sighandler(int signum)
         break;
     }
 
-    if (daemon.mHandle) {
+    if (daemon.mThreaded) {
+        // mHandle belongs to the poller thread and may be closed any time, it stops after the current poll
+        if (!first_time) {
+            std::exit(2);
+        }
+        first_time = false;
+    } else if (daemon.mHandle) {
         if (first_time) {
+            // sane_cancel may be called from a signal handler
             first_time = false;
-            daemon.log("Trying to stop scanner", 1);
-            sane_cancel(daemon.mHandle);
+            daemon.mSane.cancel(daemon.mHandle);
         } else {
-            daemon.log("Aborting", 1);
             std::exit(2);
         }
     }
@@ -23,11 +23,36 @@
 #define INSANEDAEMON_H
 
 #include <vector>
+#include <atomic>
 #include <map>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <ostream>
+#include <csignal>
+#include <sys/types.h>
 
 #include <sane/sane.h>
 
+#include "DeviceHealth.h"
+#include "EventJournal.h"
+#include "EventServer.h"
+#ifdef INSANE_LEAN
+#include "FixedMap.h"
+#include "config.h"
+#endif
+#include "GestureEngine.h"
+#include "PollerProcess.h"
+#include "ProcessWatcher.h"
+#include "ResourceClass.h"
+#include "SaneBackend.h"
+#include "SaneProxy.h"
+#include "SensorQuarantine.h"
+#include "SensorTrace.h"
+#include "SpscRing.h"
+#include "UsbPower.h"
+
 
 /** Simple SANE button polling daemon.
  */
@@ -72,15 +97,137 @@ public:
      */
     void init(std::string device_name, std::string events_dir, int sleep_ms, int verbose, bool log_to_syslog, bool suspend_after_event);
 
+    /**
+     * Load the backend of the current device (or SANE_DEFAULT_DEVICE) directly, bypassing the dll
+     * meta-backend. Must be called after init() and before anything else.
+     */
+    void load_backend();
+
+    /**
+     * Do not poll sensors at all while a process with one of the given names is running.
+     *
+     * @param names
+     */
+    void pause_while(const std::vector<std::string> & names);
+
+    /**
+     * Poll in short bursts separated by pauses longer than the USB autosuspend delay,
+     * so that the scanner can be suspended between them.
+     *
+     * @param idle_ms pause between bursts, 0 to derive it from the autosuspend delay
+     */
+    void power_save(int idle_ms);
+
+    /**
+     * Serve the polled device with the SANE network protocol on given port of localhost,
+     * so that event handler scripts can scan without opening the device a second time.
+     *
+     * @param port
+     */
+    void serve_sane(int port);
+
+    /**
+     * Push dispatched events to clients connected to the given Unix domain socket.
+     *
+     * @param socket_path
+     */
+    void serve_events(const std::string & socket_path);
+
+    /**
+     * Read sensors in a separate thread, so that dispatching events does not delay the next poll.
+     */
+    void threads();
+
+    /**
+     * Keep polling while event handler scripts run, for handlers that do not use the device
+     * (or only through the SANE proxy), so that further presses are noticed meanwhile.
+     */
+    void poll_during_handlers();
+
+    /**
+     * Dispatch gestures (e.g. scan.long, scan.double, scan+copy) instead of plain button presses.
+     *
+     * @param long_ms hold time for a long press
+     * @param double_ms longest pause between two presses of a double press
+     * @param chord_ms longest time between pressing the buttons of a chord
+     */
+    void gestures(int long_ms, int double_ms, int chord_ms);
+
+    /**
+     * Run event handler scripts with the given nice level, I/O priority, CPU affinity and cgroup.
+     *
+     * @param spec e.g. "nice=10 ioprio=idle cpus=1", see ResourceClass
+     */
+    void handler_class(const std::string & spec);
+
+    /**
+     * Append dispatched events and handler exits to the given journal file.
+     *
+     * @param journal_file
+     */
+    void journal(const std::string & journal_file);
+
+    /**
+     * Poll sensors in a separate process, which is killed and restarted if a poll
+     * takes longer than the given deadline.
+     *
+     * @param deadline_ms
+     */
+    void isolate_poller(int deadline_ms);
+
+    /**
+     * Write poll, SANE call, event and handler timings as Chrome trace events into the given file.
+     *
+     * @param trace_file
+     */
+    void trace(const std::string & trace_file);
+
+    /**
+     * Record every poll result of the main loop to the given trace file.
+     *
+     * @param trace_file
+     */
+    void record(const std::string & trace_file);
+
+    /**
+     * Apply the settings of the given configuration file, which override the command line.
+     * On SIGHUP, the file is read again and only the settings that changed are applied,
+     * keeping the sensors, debounce and suspend state and running event handler scripts.
+     * A setting removed from the file gets its value from before the file again.
+     *
+     * @param config_file
+     */
+    void config(const std::string & config_file);
+
     /**
      * Run main loop and poll sensors.
      */
     void run();
 
     /**
-     * @return currently used device name
+     * Feed samples from the given trace file through event processing as fast as possible,
+     * without calling the event handler scripts, and report dispatch decisions.
+     * The polling period is taken from the trace.
+     *
+     * @param trace_file
+     * @param out stream to write the report to
+     */
+    void replay(const std::string & trace_file, std::ostream & out);
+
+    /**
+     * Poll the current device the given number of times, both opening it for every poll as
+     * the daemon does and with a handle that stays open, and report latency percentiles of
+     * every SANE call along with the minimum safe polling interval.
+     *
+     * @param polls
+     * @param out stream to write the report to
+     */
+    void benchmark(int polls, std::ostream & out);
+
+    /**
+     * @return currently used device name, may be called from any thread
      */
-    std::string current_device() noexcept;
+    std::string current_device() const noexcept;
 
     /**
      * Try to fetch SANE version.
@@ -95,10 +242,12 @@ public:
     const std::vector<std::string> get_devices();
 
     /**
-     * Try to fetch list of detected sensors and their state (true: on, false: off)
-     * @return sensor names and values
+     * Try to fetch list of detected buttons and their state (true: on, false: off)
+     * @param changes if not null, int, fixed and string sensors whose value changed since the
+     *                previous call are appended to it, all of them on the first call
+     * @return button names and values
      */
-    std::vector<std::pair<std::string, bool>> get_sensors();
+    std::vector<std::pair<std::string, bool>> get_sensors(std::vector<std::pair<std::string, std::string>> * changes = nullptr);
 
 private:
     /// Timeout in ms to skip events for after trigger (avoid multiple invocations)
@@ -107,23 +256,70 @@ private:
     /// Timeout in ms to suspend main loop when device is busy
     static const int BUSY_TIMEOUT_MS;
 
+    /// Longest time in ms to wait for process notifications while polling is paused
+    static const int PAUSE_TIMEOUT_MS;
+
+    /// Time in ms after which slow device enumeration is reported
+    static const int ENUM_DEADLINE_MS;
+
+    /// Polling period in ms while a gesture is in progress
+    static const int GESTURE_BURST_MS;
+
+    /// Polls starting later than this many ms after their scheduled time are counted as late
+    static const int LATE_POLL_MS;
+
+    /// Number of polls between pauses in power saving mode
+    static const int POWER_BURST_SAMPLES;
+
+    /// Timer slack in ms in power saving mode
+    static const int POWER_TIMER_SLACK_MS;
+
+    /// Autosuspend delay in ms assumed if it cannot be read from sysfs
+    static const long DEFAULT_AUTOSUSPEND_DELAY_MS = 2000;
+
     /// Singleton instance
     static InsaneDaemon mInstance;
 
+#ifdef INSANE_LEAN
+    /// Buttons by name, without heap allocations for the table itself
+    typedef FixedMap<std::string, int, INSANE_MAX_SENSORS> SensorTable;
+
+    /// Debounce deadlines by event name
+    typedef FixedMap<std::string, long long, INSANE_MAX_EVENTS> EventTable;
+#else
+    /// Buttons by name
+    typedef std::map<std::string, int> SensorTable;
+
+    /// Debounce deadlines by event name
+    typedef std::map<std::string, long long> EventTable;
+#endif
+
+    /// SANE backend entry points
+    SaneBackend mSane;
+
+    /// True iff sane_init was called
+    bool mSaneInitialized = false;
+
     /// Current SANE device handle
     SANE_Handle mHandle = nullptr;
 
     /// SANE version
     SANE_Int mVersionCode = 0;
 
-    /// Device to use
+    /// Device to use, only changed by the polling thread under mDeviceMutex
     std::string mCurrentDevice = "";
 
+    /// Guards mCurrentDevice for readers in other threads, see current_device()
+    mutable std::mutex mDeviceMutex;
+
     /// Directory where event scripts are located
     std::string mEventsDir = "";
 
     /// Time in ms to sleep between polling the sensors
-    int mSleepMs = 500;
+    std::atomic<int> mSleepMs{500};
+
+    /// Set when mSleepMs changed, the poller applies it to mHealth
+    std::atomic<bool> mPeriodChanged{false};
 
     /// If true, log(..) will log to syslog
     bool mLogToSyslog = false;
@@ -131,23 +327,284 @@ private:
     /// Suspend main loop right after event handler script was successfully executed, assuming that device is busy
     bool mSuspendAfterEvent = false;
 
+    /// Poll while event handler scripts run, otherwise a handler has the device to itself
+    bool mPollDuringHandlers = false;
+
     /// List of detected devices
     std::vector<std::string> mDevices;
 
     /// Map of detected buttons (name -> option index)
-    std::map<std::string, int> mSensors;
+    SensorTable mSensors;
+
+    /// Int, fixed or string sensor
+    struct ValueSensor {
+        /// Option name
+        std::string name;
+        /// Option index
+        int option;
+        /// Option type
+        SANE_Value_Type type;
+        /// Position of the value in mSnapshot
+        size_t offset;
+        /// Size of the value
+        size_t size;
+    };
+
+    /// Detected sensors that are not buttons
+    std::vector<ValueSensor> mValueSensors;
+
+    /// Raw values of mValueSensors from the current poll, packed back to back
+    std::vector<char> mSnapshot;
+
+    /// Raw values of mValueSensors from the previous poll
+    std::vector<char> mPrevSnapshot;
+
+    /// True iff mPrevSnapshot holds values
+    bool mSnapshotValid = false;
+
+    /// Set when the backend reports that options have to be reloaded
+    bool mReloadOptions = false;
+
+    /// Last dispatched value of each value sensor (name -> value)
+    std::map<std::string, std::string> mValues;
 
     /// Verbosity level
-    int mVerbose = 0;
+    std::atomic<int> mVerbose{0};
 
     /// Main loop is run while true
-    bool mRun = false;
+    std::atomic<bool> mRun{false};
+
+    /// Monotonic time in us until which polling is suspended because the device is busy, also set by the poller thread
+    std::atomic<long long> mSuspendUntilUs{0};
+
+    /// Sample time in us until which an event is skipped after trigger, only events that are still skipped are kept
+    EventTable mSkipUntilUs;
+
+    /// Status of the last failed SANE operation during current poll
+    SANE_Status mLastStatus = SANE_STATUS_GOOD;
+
+    /// Trace of recorded samples, if recording
+    SensorTrace mTrace;
+
+    /// Do not execute event handler scripts while true
+    bool mDryRun = false;
+
+    /// True iff the device could not be opened during current poll
+    bool mOpenFailed = false;
+
+    /// Backoff state of the current device
+    DeviceHealth mHealth{500};
+
+    /// Guards mHealth and the poll lateness counters, which log_stats() reads from the main thread
+    std::mutex mStatsMutex;
+
+    /// Poll sensors in mPoller if true
+    bool mIsolated = false;
+
+    /// Maximal time in ms to wait for mPoller
+    int mPollDeadlineMs = 0;
+
+    /// Process polling the sensors
+    PollerProcess mPoller;
+
+    /// Running event handler script
+    struct Handler {
+        /// Event name
+        std::string name;
+        /// Script path
+        std::string handler;
+        /// Device that triggered the event
+        std::string device;
+        /// Monotonic start time in us
+        long long start_us;
+    };
+
+    /// Resource limits of event handler scripts
+    ResourceClass mHandlerClass;
+
+    /// Resource limits of the handler scripts of single events, override mHandlerClass
+    std::map<std::string, ResourceClass> mEventClasses;
+
+    /// Running event handler scripts by pid
+    std::map<pid_t, Handler> mHandlers;
+
+    /// Time of the sample being dispatched
+    long long mSampleTimeUs = 0;
+
+    /// Device of the sample being dispatched
+    std::string mSampleDevice;
+
+    /// Dispatch gestures instead of button presses
+    bool mGesturesEnabled = false;
+
+    /// Recognizes gestures
+    GestureEngine mGestures{1000, 400, 150};
+
+    /// Suppresses events of stuck and flapping sensors
+    SensorQuarantine mQuarantine;
+
+    /// Guards mQuarantine, which the poller thread updates and log_stats() reads
+    std::mutex mQuarantineMutex;
+
+    /// Held while the device is polled or used by a SANE net client
+    std::mutex mSaneMutex;
+
+    /// Serves the device to SANE net clients
+    SaneProxy mProxy{mSane, mSaneMutex};
+
+    /// Port of mProxy, 0 if disabled
+    int mProxyPort = 0;
+
+    /// Lists devices in background at startup
+    std::thread mEnumThread;
+
+    /// Devices found by mEnumThread, guarded by mEnumMutex
+    std::vector<std::string> mFoundDevices;
+
+    /// Guards mFoundDevices
+    std::mutex mEnumMutex;
+
+    /// Set by mEnumThread when mFoundDevices is complete
+    std::atomic<bool> mEnumDone{false};
+
+    /// True until the devices found by mEnumThread are merged
+    std::atomic<bool> mEnumPending{false};
+
+    /// True iff there is no device to poll until mEnumThread is done
+    std::atomic<bool> mWaitingForDevice{false};
+
+    /// True iff the enumeration was reported to be slow
+    bool mEnumLate = false;
+
+    /// Start time of mEnumThread
+    long long mEnumStartUs = 0;
+
+    /// Pushes events to subscribed clients
+    EventServer mServer;
+
+    /// Path of the event socket, if events should be published
+    std::string mServerPath;
+
+    /// Journal of events and handler exits
+    EventJournal mJournal;
+
+    /// Processes that pause polling
+    ProcessWatcher mWatcher;
+
+    /// True while polling is paused by mWatcher
+    bool mPaused = false;
+
+    /// Sample passed from the poller thread to the main thread
+    struct QueuedSample {
+        SensorSample sample;
+        /// Monotonic time the sample was queued in us
+        long long queued_us = 0;
+    };
+
+    /// Poll in a separate thread if true
+    bool mThreaded = false;
+
+    /// Samples from the poller thread
+    SpscRing<QueuedSample, 64> mQueue;
+
+    /// Wakes up the main thread when a sample was queued
+    int mQueuePipe[2] = {-1, -1};
+
+    /// Wakes up the poller thread
+    int mPollerPipe[2] = {-1, -1};
+
+    /// Poller thread may read sensors while true
+    std::atomic<bool> mPollGate{false};
+
+    /// Poller thread samples faster while true
+    std::atomic<bool> mBurst{false};
+
+    /// Samples dropped because the queue was full
+    std::atomic<long> mQueueDrops{0};
+
+    /// Samples taken from the queue
+    std::atomic<long> mQueuePopped{0};
+
+    /// Largest observed queue depth
+    std::atomic<long> mQueueMaxDepth{0};
+
+    /// Total time between queuing and taking samples in us
+    std::atomic<long long> mQueueLatencySumUs{0};
+
+    /// Longest time between queuing and taking a sample in us
+    std::atomic<long long> mQueueLatencyMaxUs{0};
+
+    /// Monotonic time of the next poll in us
+    long long mNextPollUs = 0;
+
+    /// True iff mNextPollUs was set by schedule_poll and polling was not paused since
+    bool mPollScheduled = false;
+
+    /// Number of polls whose start time was measured
+    long mTimedPolls = 0;
+
+    /// Total time between scheduled and actual start of polls in us
+    long long mPollLateSumUs = 0;
+
+    /// Longest time between scheduled and actual start of a poll in us
+    long long mPollLateMaxUs = 0;
+
+    /// Number of polls that started more than LATE_POLL_MS late
+    long mLatePolls = 0;
 
-    /// Counter to suspend the main loop when device is busy
-    int mSuspendCount = 0;
+    /// Poll in bursts if true
+    bool mPowerSave = false;
 
-    /// Used to skip events after trigger
-    std::map<std::string, int> mRepeatCount;
+    /// Pause between bursts in ms
+    long long mPowerIdleMs = 0;
+
+    /// Polls left in the current burst
+    int mBurstLeft = 0;
+
+    /// Power state of the device
+    UsbPower mUsb;
+
+    /// Time power saving was started
+    long long mPowerStartUs = 0;
+
+    /// Suspended time of the device when power saving was started, -1 if unknown
+    long long mSuspendedStartMs = -1;
+
+    /// Number of main loop iterations
+    std::atomic<long> mWakeups{0};
+
+    /// Number of polls
+    std::atomic<long> mPolls{0};
+
+    /// Configuration file, empty if none
+    std::string mConfigPath;
+
+    /// Settings applied from mConfigPath (key -> value)
+    std::map<std::string, std::string> mConfig;
+
+    /// Values of the settings in mConfig before the file set them, restored when a key is removed
+    std::map<std::string, std::string> mBaseline;
+
+    /// Events of these sensors are not dispatched
+    std::set<std::string> mIgnored;
+
+    /// Record SANE call durations in mTimings if true
+    bool mBenchmarking = false;
+
+    /// Durations of SANE calls in us, by name
+    std::map<std::string, std::vector<long long> > mTimings;
+
+    /// Set to fetch sensors again and restart mPoller, read by the poller thread
+    std::atomic<bool> mRestartPoller{false};
+
+    /// Set by signal handler to reload mConfigPath
+    volatile sig_atomic_t mReloadRequested = false;
+
+    /// Set by signal handler to request logging of statistics
+    volatile sig_atomic_t mStatsRequested = false;
+
+    /// Last signal received, logged by the main loop
+    volatile sig_atomic_t mLastSignal = 0;
 
 
     /** Constructor
@@ -159,6 +616,11 @@ private:
     InsaneDaemon & operator=(const InsaneDaemon &);
 
 
+    /**
+     * Initialize SANE, if not done yet
+     */
+    void init_sane() noexcept;
+
     /**
      * Open given device
      * @param device_name
@@ -200,22 +662,269 @@ private:
     std::pair<std::string, bool> fetch_sensor_value(int opt_num);
 
     /**
-     * Fetch and cache internal list of sensors (mSensors)
+     * Fetch and cache internal list of sensors (mSensors and mValueSensors)
      */
     void fetch_sensors();
 
+    /**
+     * @return true iff all sensors still have the same option index, name, type and size
+     */
+    bool sensors_valid();
+
+    /**
+     * Fetch the list of sensors again, keeping the previous values of sensors that did not change
+     */
+    void update_sensors();
+
+    /**
+     * Read all int, fixed and string sensors into mSnapshot
+     * @param changes sensors whose value differs from the previous snapshot are appended to it
+     */
+    void fetch_sensor_values(std::vector<std::pair<std::string, std::string>> & changes);
+
+    /**
+     * @param sensor
+     * @param value raw value as read by sane_control_option
+     * @return value formatted for event handler scripts
+     */
+    static std::string format_value(const ValueSensor & sensor, const char * value);
+
+    /**
+     * Apply a single setting of the configuration file
+     * @param key
+     * @param value
+     */
+    void apply_setting(const std::string & key, const std::string & value);
+
+    /**
+     * @param key setting of the configuration file
+     * @return current value in the syntax of the configuration file
+     */
+    std::string setting(const std::string & key) const;
+
+    /**
+     * Read the configuration file again and apply the settings that changed,
+     * or fetch the sensors again if there is no configuration file
+     */
+    void reload_config() noexcept;
+
+    /**
+     * Run the main loop with a separate poller thread, the calling thread dispatches events
+     */
+    void run_threaded();
+
+    /**
+     * Poller thread, reads sensors and queues the samples
+     */
+    void poller_thread() noexcept;
+
+    /**
+     * Record the duration of a SANE call while benchmarking
+     * @param name
+     * @param detail appended to name, e.g. option name
+     * @param us
+     */
+    void timing(const char * name, const char * detail, long long us);
+
+    /**
+     * Print percentiles of recorded durations of given name
+     * @param name
+     * @param out
+     */
+    void print_timing(const std::string & name, std::ostream & out);
+
+    /**
+     * Start listing devices in background and pick a device to poll meanwhile
+     * from SANE_DEFAULT_DEVICE or the device found last time
+     */
+    void start_enumeration();
+
+    /**
+     * Body of mEnumThread
+     */
+    void enumerate_devices() noexcept;
+
+    /**
+     * Take over the devices found by mEnumThread, if it is done,
+     * and switch to the first one if the current device is not usable.
+     * Called by the thread that polls the device.
+     */
+    void merge_devices();
+
+    /**
+     * @return true iff the next poll is due
+     */
+    bool poll_due() const noexcept;
+
+    /**
+     * Schedule the next poll after a poll, depending on device health, gestures and power saving
+     */
+    void schedule_poll() noexcept;
+
+    /**
+     * @return time in ms until the next poll is due
+     */
+    long long poll_delay_ms() const noexcept;
+
+    /**
+     * Find the device in sysfs and derive the pause between bursts from its autosuspend delay
+     */
+    void setup_power_save();
+
+    /**
+     * Update pause and suspend state for the next period
+     * @param next_ms set to the time to wait for wake_fd
+     * @param wake_fd set to a file descriptor that ends the pause
+     * @return true iff sensors may be read
+     */
+    bool poll_allowed(long long & next_ms, int & wake_fd) noexcept;
+
+    /**
+     * Poll all sensors once and process the result
+     */
+    void poll_once();
+
+    /**
+     * Poll all sensors once and update device health
+     * @return sample with the poll status and sensor values
+     */
+    SensorSample take_sample() noexcept;
+
+    /**
+     * Ask the poller process for a sample without waiting for it, a failure is processed right away
+     */
+    void request_isolated();
+
+    /**
+     * Receive the sample requested by request_isolated(), or the failure after its deadline, and process it
+     */
+    void receive_isolated();
+
+    /**
+     * Count how late a scheduled poll starts
+     */
+    void count_lateness() noexcept;
+
+    /**
+     * Apply a changed period and restart the poller process if requested, before a poll
+     */
+    void prepare_poll() noexcept;
+
+    /**
+     * Update device health and power saving bursts with the result of a poll
+     * @param sample
+     * @return sample
+     */
+    SensorSample finish_sample(SensorSample sample) noexcept;
+
+    /**
+     * Process the result of a poll: suspend on busy device, record and dispatch events
+     * @param sample
+     */
+    void handle_sample(const SensorSample & sample);
+
+    /**
+     * Poll all sensors once
+     * @return sample with the poll status and sensor values
+     */
+    SensorSample poll() noexcept;
+
+    /**
+     * Poll all sensors once in the poller process
+     * @return sample with the poll status and sensor values
+     */
+    SensorSample poll_isolated() noexcept;
+
+    /**
+     * Make the sample of a poll in the poller process, or a failed sample
+     * @param ok true iff the poller process answered
+     * @param sample its answer
+     * @param error description of the failure otherwise
+     * @return sample with the poll status and sensor values
+     */
+    SensorSample isolated_result(bool ok, SensorSample sample, const std::string & error) noexcept;
+
+    /**
+     * Update device health with the result of a poll
+     * @param sample
+     */
+    void update_health(const SensorSample & sample) noexcept;
+
+    /**
+     * Change the device, called by the polling thread only
+     * @param device_name
+     */
+    void set_current_device(const std::string & device_name);
+
+    /**
+     * Log runtime statistics, called by the main thread only
+     * @param verbosity
+     */
+    void log_stats(int verbosity) noexcept;
+
+    /**
+     * Wait in the main loop for given time, serving event subscribers meanwhile
+     * @param ms
+     * @param fd wake up when this file descriptor becomes readable, if not -1
+     */
+    void wait_events(long long ms, int fd);
+
+    /**
+     * Sleep for given time, or until a signal arrives or given file descriptor becomes readable
+     * @param ms
+     * @param fd
+     */
+    void sleep_ms(long long ms, int fd = -1) noexcept;
+
+    /**
+     * Update event skip counters and process events for all sensors that are on
+     * @param sample
+     * @return names of the events that were not skipped
+     */
+    std::vector<std::string> dispatch(const SensorSample & sample);
+
     /**
      * Execute event script, if it exists.
      *
      * @param name sensor name
+     * @param value new value of an int, fixed or string sensor, nullptr for buttons.
+     *              Value changes are not debounced.
+     * @return false if the event was skipped
      */
-    void process_event(std::string name);
+    bool process_event(std::string name, const std::string * value = nullptr);
+
+    /**
+     * Start the handler script of given event, if it exists
+     *
+     * @param name event name
+     * @param value passed to the script, if not null
+     */
+    void run_handler(const std::string & name, const std::string * value);
+
+    /**
+     * Start given event handler script in background
+     *
+     * @param name event name
+     * @param handler script path
+     * @param value passed as the second argument after the device, if not null
+     */
+    void spawn_handler(const std::string & name, const std::string & handler, const std::string * value);
+
+    /**
+     * Collect exit status of finished event handler scripts
+     */
+    void reap_handlers() noexcept;
 
     /**
      * Signal handler
      * @param signum
      */
     static void sighandler(int signum);
+
+    /**
+     * Log the signal recorded by sighandler(), which must not log itself
+     */
+    void log_signal() noexcept;
 };
 
 
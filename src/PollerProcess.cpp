@@ -0,0 +1,306 @@
+
+#include "PollerProcess.h"
+#include "InsaneException.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Timer.h"
+
+
+namespace {
+
+/// Time in ms to wait for the child to exit after closing its socket
+const int EXIT_TIMEOUT_MS = 1000;
+
+/// Largest accepted message
+const uint32_t MAX_MESSAGE_SIZE = 1 << 20;
+
+
+/**
+ * Write all given data, ignoring SIGPIPE
+ * @return false on error
+ */
+bool send_all(int fd, const char * data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+
+/**
+ * Read exactly given amount of data, waiting at most until deadline_us (monotonic), or forever if negative
+ * @return false on error, timeout or end of file
+ */
+bool recv_all(int fd, char * data, size_t size, long long deadline_us, std::string & error)
+{
+    while (size > 0) {
+        if (deadline_us >= 0) {
+            long long left_ms = (deadline_us - Timer::monotonic_us()) / 1000;
+            if (left_ms <= 0) {
+                error = "deadline exceeded";
+                return false;
+            }
+            pollfd pfd = {fd, POLLIN, 0};
+            int ready = ::poll(&pfd, 1, static_cast<int>(left_ms));
+            if (ready < 0 && errno != EINTR) {
+                error = std::string("poll failed: ") + strerror(errno);
+                return false;
+            }
+            if (ready <= 0) {
+                continue;
+            }
+        }
+        ssize_t n = recv(fd, data, size, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = std::string("read failed: ") + strerror(errno);
+            return false;
+        }
+        if (n == 0) {
+            error = "connection closed";
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+}
+
+
+PollerProcess::PollerProcess()
+{
+}
+
+
+PollerProcess::~PollerProcess() noexcept
+{
+    stop();
+}
+
+
+void PollerProcess::set_functions(InitFunc init, PollFunc poll, ExitFunc exit)
+{
+    mInit = init;
+    mPoll = poll;
+    mExit = exit;
+}
+
+
+bool PollerProcess::poll(SensorSample & sample, int deadline_ms, std::string & error)
+{
+    return request(deadline_ms, error) && receive(sample, error);
+}
+
+
+bool PollerProcess::request(int deadline_ms, std::string & error)
+{
+    mDeadlineUs = Timer::monotonic_us() + static_cast<long long>(deadline_ms) * 1000;
+    if (!mPid && !start(error)) {
+        mFailures++;
+        return false;
+    }
+
+    char request = 'P';
+    if (!send_all(mSocket, &request, 1)) {
+        error = std::string("could not send poll request: ") + strerror(errno);
+        fail(error);
+        return false;
+    }
+    mPending = true;
+    return true;
+}
+
+
+bool PollerProcess::receive(SensorSample & sample, std::string & error)
+{
+    mPending = false;
+    uint32_t size = 0;
+    std::string message;
+    if (recv_all(mSocket, reinterpret_cast<char *>(&size), sizeof(size), mDeadlineUs, error)) {
+        if (size > MAX_MESSAGE_SIZE) {
+            error = "message too long";
+        } else {
+            message.resize(size);
+            if (recv_all(mSocket, &message[0], size, mDeadlineUs, error)) {
+                try {
+                    SensorTrace::decode(message, sample);
+                    return true;
+                } catch (InsaneException & e) {
+                    error = e.what();
+                }
+            }
+        }
+    }
+    fail(error);
+    return false;
+}
+
+
+bool PollerProcess::pending() const noexcept
+{
+    return mPending;
+}
+
+
+bool PollerProcess::ready() const noexcept
+{
+    if (Timer::monotonic_us() >= mDeadlineUs) {
+        return true;
+    }
+    // also readable at end of file, when the child died
+    pollfd pfd = {mSocket, POLLIN, 0};
+    return ::poll(&pfd, 1, 0) > 0;
+}
+
+
+int PollerProcess::fd() const noexcept
+{
+    return mSocket;
+}
+
+
+long long PollerProcess::time_left_ms() const noexcept
+{
+    return std::max((mDeadlineUs - Timer::monotonic_us() + 999) / 1000, 1LL);
+}
+
+
+void PollerProcess::fail(std::string & error) noexcept
+{
+    try {
+        error = "poller process " + std::to_string(mPid.load()) + ": " + error;
+    } catch (...) {
+        // keep the error without the pid
+    }
+    // the state of the child is unknown, start over
+    stop(true);
+    mFailures++;
+}
+
+
+void PollerProcess::stop(bool kill) noexcept
+{
+    mPending = false;
+    if (mSocket >= 0) {
+        ::close(mSocket);
+        mSocket = -1;
+    }
+    if (!mPid) {
+        return;
+    }
+    if (!kill) {
+        // closed socket asks the child to exit
+        for (int i = 0; i < EXIT_TIMEOUT_MS / 10; ++i) {
+            if (waitpid(mPid, nullptr, WNOHANG) == mPid) {
+                mPid = 0;
+                return;
+            }
+            usleep(10000);
+        }
+    }
+    ::kill(mPid, SIGKILL);
+    while (waitpid(mPid, nullptr, 0) < 0 && errno == EINTR) {
+    }
+    mPid = 0;
+}
+
+
+pid_t PollerProcess::pid() const noexcept
+{
+    return mPid;
+}
+
+
+long PollerProcess::failures() const noexcept
+{
+    return mFailures;
+}
+
+
+bool PollerProcess::start(std::string & error)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        error = std::string("socketpair failed: ") + strerror(errno);
+        return false;
+    }
+    // neither the child nor event handler scripts should inherit the parent end
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        error = std::string("fork failed: ") + strerror(errno);
+        ::close(fds[0]);
+        ::close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        ::close(fds[0]);
+        child_main(fds[1]);
+    }
+    ::close(fds[1]);
+    mSocket = fds[0];
+    mPid = pid;
+    return true;
+}
+
+
+void PollerProcess::child_main(int fd)
+{
+    // the parent handles signals and closes the socket when the child should exit
+#ifdef SIGHUP
+    signal(SIGHUP, SIG_IGN);
+#endif
+#ifdef SIGUSR1
+    signal(SIGUSR1, SIG_IGN);
+#endif
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_DFL);
+    // the poller thread, which may have forked us, blocks all signals
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, nullptr);
+    if (mInit) {
+        mInit();
+    }
+
+    char request;
+    std::string error;
+    while (recv_all(fd, &request, 1, -1, error)) {
+        std::string message = SensorTrace::encode(mPoll());
+        uint32_t size = static_cast<uint32_t>(message.size());
+        if (!send_all(fd, reinterpret_cast<const char *>(&size), sizeof(size))
+                || !send_all(fd, message.data(), message.size())) {
+            break;
+        }
+    }
+    if (mExit) {
+        mExit();
+    }
+    // do not run destructors of the objects shared with the parent
+    _exit(0);
+}
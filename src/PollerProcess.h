@@ -0,0 +1,179 @@
+/*
+ *  PollerProcess.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+#ifndef POLLERPROCESS_H
+#define POLLERPROCESS_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+#include <sys/types.h>
+
+#include "SensorTrace.h"
+
+
+/** Supervised child process that polls the sensors.
+ *
+ * All SANE calls happen in the child, so a backend that hangs or crashes
+ * only takes the child down. The parent sends a poll request over a socket
+ * and waits for the sample at most for the given deadline, otherwise the
+ * child is killed and started again for the next request. The parent can
+ * either block in poll() or send the request() and wait for fd() along with
+ * its other descriptors until ready(), then receive() the sample.
+ */
+class PollerProcess
+{
+public:
+    /// Function called in the child process after it was forked
+    typedef std::function<void()> InitFunc;
+
+    /// Function called in the child process to poll the sensors
+    typedef std::function<SensorSample()> PollFunc;
+
+    /// Function called in the child process before it exits
+    typedef std::function<void()> ExitFunc;
+
+    /** Constructor
+     */
+    PollerProcess();
+
+    /** Destructor, stops the child
+     */
+    ~PollerProcess() noexcept;
+
+    /**
+     * Set functions to call in the child process. The child is started on first poll.
+     * @param init
+     * @param poll
+     * @param exit
+     */
+    void set_functions(InitFunc init, PollFunc poll, ExitFunc exit);
+
+    /**
+     * Request a poll from the child, starting it if needed.
+     * @param sample result, only valid if true was returned
+     * @param deadline_ms maximal time to wait for the result
+     * @param error description of the failure, if false was returned
+     * @return false if the child could not be started, did not answer in time or died
+     */
+    bool poll(SensorSample & sample, int deadline_ms, std::string & error);
+
+    /**
+     * Send a poll request to the child, starting it if needed. The result has to be
+     * received before the next request.
+     * @param deadline_ms maximal time to wait for the result
+     * @param error description of the failure, if false was returned
+     * @return false if the child could not be started or the request not sent
+     */
+    bool request(int deadline_ms, std::string & error);
+
+    /**
+     * Receive the result of the pending request, waits until its deadline at most
+     * @param sample result, only valid if true was returned
+     * @param error description of the failure, if false was returned
+     * @return false if the child did not answer in time or died
+     */
+    bool receive(SensorSample & sample, std::string & error);
+
+    /**
+     * @return true iff a request was sent and its result not received yet
+     */
+    bool pending() const noexcept;
+
+    /**
+     * @return true iff receive() would not block, because the child answered, died or the deadline passed
+     */
+    bool ready() const noexcept;
+
+    /**
+     * @return socket that becomes readable when the child answers, -1 if not running
+     */
+    int fd() const noexcept;
+
+    /**
+     * @return time in ms until the deadline of the pending request, at least 1
+     */
+    long long time_left_ms() const noexcept;
+
+    /**
+     * Stop the child, if running. It is started again on next poll.
+     * @param kill kill the child instead of asking it to exit
+     */
+    void stop(bool kill = false) noexcept;
+
+    /**
+     * @return pid of the child process, or 0 if not running
+     */
+    pid_t pid() const noexcept;
+
+    /**
+     * @return number of times the child had to be killed or died
+     */
+    long failures() const noexcept;
+
+private:
+    /// Child process, pid() may be called from another thread
+    std::atomic<pid_t> mPid{0};
+
+    /// Socket connected to the child
+    int mSocket = -1;
+
+    /// true iff the result of a request was not received yet
+    bool mPending = false;
+
+    /// Monotonic time in us until which the child has to answer the pending request
+    long long mDeadlineUs = 0;
+
+    /// Number of failures
+    std::atomic<long> mFailures{0};
+
+    InitFunc mInit;
+
+    PollFunc mPoll;
+
+    ExitFunc mExit;
+
+    // Forbid copy
+    PollerProcess(const PollerProcess &);
+    PollerProcess & operator=(const PollerProcess &);
+
+    /**
+     * Start the child process
+     * @param error
+     * @return true on success
+     */
+    bool start(std::string & error);
+
+    /**
+     * Kill the child after a failed request, its state is unknown
+     * @param error description of the failure, the child is prepended
+     */
+    void fail(std::string & error) noexcept;
+
+    /**
+     * Main loop of the child process, does not return
+     * @param fd socket connected to the parent
+     */
+    void child_main(int fd);
+};
+
+#endif
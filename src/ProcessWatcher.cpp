@@ -0,0 +1,254 @@
+
+#include "ProcessWatcher.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#endif
+
+
+namespace {
+
+/// Kernel truncates process names to this length
+const size_t COMM_LENGTH = 15;
+
+}
+
+
+ProcessWatcher::ProcessWatcher()
+{
+}
+
+
+ProcessWatcher::~ProcessWatcher() noexcept
+{
+    stop();
+}
+
+
+bool ProcessWatcher::start(const std::vector<std::string> & names)
+{
+    stop();
+    mNames.clear();
+    for (auto & name : names) {
+        if (!name.empty()) {
+            mNames.push_back(name.substr(0, COMM_LENGTH));
+        }
+    }
+    if (mNames.empty()) {
+        return true;
+    }
+    // subscribe before scanning, so that no process can slip through in between
+    bool connected = connect();
+    scan();
+    return connected;
+}
+
+
+void ProcessWatcher::stop() noexcept
+{
+    if (mSocket >= 0) {
+        close(mSocket);
+        mSocket = -1;
+    }
+    mRunning.clear();
+}
+
+
+const std::vector<std::string> & ProcessWatcher::names() const noexcept
+{
+    return mNames;
+}
+
+
+bool ProcessWatcher::active() const noexcept
+{
+    return !mNames.empty();
+}
+
+
+void ProcessWatcher::update()
+{
+    if (mNames.empty()) {
+        return;
+    }
+    if (mSocket < 0) {
+        scan();
+        return;
+    }
+#ifdef __linux__
+    char buf[4096] __attribute__ ((aligned(NLMSG_ALIGNTO)));
+    for (;;) {
+        ssize_t len = recv(mSocket, buf, sizeof(buf), MSG_DONTWAIT);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOBUFS) {
+                // notifications were lost, start over
+                scan();
+                continue;
+            }
+            break;
+        }
+        for (nlmsghdr * nlh = reinterpret_cast<nlmsghdr *>(buf); NLMSG_OK(nlh, static_cast<unsigned>(len)); nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type != NLMSG_DONE) {
+                continue;
+            }
+            auto msg = static_cast<cn_msg *>(NLMSG_DATA(nlh));
+            if (msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC) {
+                continue;
+            }
+            auto event = reinterpret_cast<proc_event *>(msg->data);
+            std::string name;
+            switch (event->what) {
+            case proc_event::PROC_EVENT_FORK:
+                // e.g. a watched program restarting itself
+                if (mRunning.find(event->event_data.fork.parent_tgid) != mRunning.end()
+                        && event->event_data.fork.child_pid == event->event_data.fork.child_tgid) {
+                    mRunning[event->event_data.fork.child_tgid] = mRunning[event->event_data.fork.parent_tgid];
+                }
+                break;
+            case proc_event::PROC_EVENT_EXEC:
+                if (matches(event->event_data.exec.process_tgid, name)) {
+                    mRunning[event->event_data.exec.process_tgid] = name;
+                } else {
+                    mRunning.erase(event->event_data.exec.process_tgid);
+                }
+                break;
+            case proc_event::PROC_EVENT_EXIT:
+                if (event->event_data.exit.process_pid == event->event_data.exit.process_tgid) {
+                    mRunning.erase(event->event_data.exit.process_tgid);
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+#endif
+}
+
+
+bool ProcessWatcher::any_running() const noexcept
+{
+    return !mRunning.empty();
+}
+
+
+std::string ProcessWatcher::running() const
+{
+    if (mRunning.empty()) {
+        return "";
+    }
+    return mRunning.begin()->second + " (" + std::to_string(mRunning.begin()->first) + ")";
+}
+
+
+int ProcessWatcher::fd() const noexcept
+{
+    return mSocket;
+}
+
+
+bool ProcessWatcher::connect() noexcept
+{
+#ifdef __linux__
+    int fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_CONNECTOR);
+    if (fd < 0) {
+        return false;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    addr.nl_pid = 0;
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return false;
+    }
+
+    // there can be many execs between two updates
+    int size = 1 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    char request[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))] __attribute__ ((aligned(NLMSG_ALIGNTO)));
+    memset(request, 0, sizeof(request));
+    auto nlh = reinterpret_cast<nlmsghdr *>(request);
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+    nlh->nlmsg_type = NLMSG_DONE;
+    nlh->nlmsg_pid = static_cast<__u32>(getpid());
+    auto msg = static_cast<cn_msg *>(NLMSG_DATA(nlh));
+    msg->id.idx = CN_IDX_PROC;
+    msg->id.val = CN_VAL_PROC;
+    msg->len = sizeof(proc_cn_mcast_op);
+    *reinterpret_cast<proc_cn_mcast_op *>(msg->data) = PROC_CN_MCAST_LISTEN;
+    if (send(fd, request, nlh->nlmsg_len, 0) < 0) {
+        close(fd);
+        return false;
+    }
+    mSocket = fd;
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+void ProcessWatcher::scan()
+{
+    mRunning.clear();
+    DIR * dir = opendir("/proc");
+    if (!dir) {
+        return;
+    }
+    while (dirent * entry = readdir(dir)) {
+        char * end = nullptr;
+        long pid = strtol(entry->d_name, &end, 10);
+        if (pid <= 0 || *end != '\0') {
+            continue;
+        }
+        std::string name;
+        if (matches(static_cast<pid_t>(pid), name)) {
+            mRunning[static_cast<pid_t>(pid)] = name;
+        }
+    }
+    closedir(dir);
+}
+
+
+bool ProcessWatcher::matches(pid_t pid, std::string & name) const
+{
+    std::string path = "/proc/" + std::to_string(pid) + "/comm";
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    char buf[64];
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+        return false;
+    }
+    std::string comm(buf, static_cast<size_t>(len));
+    if (!comm.empty() && comm.back() == '\n') {
+        comm.pop_back();
+    }
+    for (auto & watched : mNames) {
+        if (comm == watched) {
+            name = watched;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,125 @@
+/*
+ *  ProcessWatcher.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+#ifndef PROCESSWATCHER_H
+#define PROCESSWATCHER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+
+/** Tracks whether any process with one of the given names is running.
+ *
+ * On Linux, exec/fork/exit notifications of the netlink proc connector keep
+ * the set of matching processes up to date, so /proc is only scanned once
+ * at start (and after lost notifications). The proc connector requires
+ * CAP_NET_ADMIN, without it /proc is scanned on every update() instead.
+ */
+class ProcessWatcher
+{
+public:
+    /** Constructor
+     */
+    ProcessWatcher();
+
+    /** Destructor, closes the netlink socket
+     */
+    ~ProcessWatcher() noexcept;
+
+    /**
+     * Start watching for the given process names (as shown by ps -o comm)
+     * @param names
+     * @return false if the proc connector is not available and /proc will be scanned instead
+     */
+    bool start(const std::vector<std::string> & names);
+
+    /**
+     * Stop watching
+     */
+    void stop() noexcept;
+
+    /**
+     * @return watched process names
+     */
+    const std::vector<std::string> & names() const noexcept;
+
+    /**
+     * @return true iff start() was called with at least one name
+     */
+    bool active() const noexcept;
+
+    /**
+     * Process pending notifications without blocking, or scan /proc if notifications are not available
+     */
+    void update();
+
+    /**
+     * @return true iff a matching process is running, as of last update()
+     */
+    bool any_running() const noexcept;
+
+    /**
+     * @return description of a matching process, e.g. "xsane (1234)", or empty string
+     */
+    std::string running() const;
+
+    /**
+     * @return file descriptor that becomes readable when notifications arrive, or -1
+     */
+    int fd() const noexcept;
+
+private:
+    /// Process names to watch
+    std::vector<std::string> mNames;
+
+    /// Netlink socket, -1 if not available
+    int mSocket = -1;
+
+    /// Matching processes: pid -> name
+    std::map<pid_t, std::string> mRunning;
+
+    // Forbid copy
+    ProcessWatcher(const ProcessWatcher &);
+    ProcessWatcher & operator=(const ProcessWatcher &);
+
+    /**
+     * Subscribe to the proc connector
+     * @return false if not available
+     */
+    bool connect() noexcept;
+
+    /**
+     * Rebuild the set of matching processes from /proc
+     */
+    void scan();
+
+    /**
+     * @param pid
+     * @param name set to the matching name
+     * @return true iff the process has one of the watched names
+     */
+    bool matches(pid_t pid, std::string & name) const;
+};
+
+#endif
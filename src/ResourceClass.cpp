@@ -0,0 +1,218 @@
+
+#include "ResourceClass.h"
+#include "InsaneException.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+
+namespace {
+
+/// I/O priority classes and encoding, see ioprio_set(2)
+const int IOPRIO_CLASS_SHIFT = 13;
+const int IOPRIO_CLASS_RT = 1;
+const int IOPRIO_CLASS_BE = 2;
+const int IOPRIO_CLASS_IDLE = 3;
+const int IOPRIO_WHO_PROCESS = 1;
+
+/// Period of cpu.max in us
+const long CPU_MAX_PERIOD_US = 100000;
+
+
+/**
+ * @return value of a number in given range
+ */
+long long parse_number(const std::string & text, long long min, long long max, const std::string & what)
+{
+    char * end = nullptr;
+    errno = 0;
+    long long value = strtoll(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || errno != 0 || value < min || value > max) {
+        throw InsaneException("Invalid " + what + " '" + text + "', expected " + std::to_string(min) + ".." + std::to_string(max));
+    }
+    return value;
+}
+
+}
+
+
+ResourceClass::ResourceClass()
+{
+#ifdef __linux__
+    CPU_ZERO(&mCpus);
+#endif
+}
+
+
+ResourceClass::ResourceClass(const std::string & spec)
+    : ResourceClass()
+{
+    mSpec = spec;
+    std::istringstream in(spec);
+    std::string field;
+    while (in >> field) {
+        auto pos = field.find('=');
+        if (pos == std::string::npos) {
+            throw InsaneException("Invalid resource limit '" + field + "', expected NAME=VALUE");
+        }
+        std::string name = field.substr(0, pos);
+        std::string value = field.substr(pos + 1);
+        if (name == "nice") {
+            mNice = static_cast<int>(parse_number(value, -20, 19, "nice level"));
+            mHasNice = true;
+        } else if (name == "ioprio") {
+            std::string level = "4";
+            pos = value.find(':');
+            if (pos != std::string::npos) {
+                level = value.substr(pos + 1);
+                value = value.substr(0, pos);
+            }
+            if (value == "idle") {
+                mIoprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+            } else if (value == "best-effort" || value == "realtime") {
+                int io_class = value == "realtime" ? IOPRIO_CLASS_RT : IOPRIO_CLASS_BE;
+                mIoprio = (io_class << IOPRIO_CLASS_SHIFT) | static_cast<int>(parse_number(level, 0, 7, "I/O priority level"));
+            } else {
+                throw InsaneException("Invalid I/O priority class '" + value + "', expected idle, best-effort or realtime");
+            }
+        } else if (name == "cpus") {
+            parse_cpus(value);
+        } else if (name == "cgroup") {
+            if (value.empty() || value[0] != '/') {
+                throw InsaneException("The cgroup must be an absolute path, e.g. /sys/fs/cgroup/insaned/handlers");
+            }
+            mCgroup = value;
+            mProcsPath = value + "/cgroup.procs";
+        } else if (name == "cpu-max") {
+            mCpuMaxPercent = static_cast<long>(parse_number(value, 1, 100000, "CPU limit in percent"));
+        } else if (name == "memory-max") {
+            long long unit = 1;
+            if (!value.empty()) {
+                switch (value.back()) {
+                case 'K': unit = 1LL << 10; break;
+                case 'M': unit = 1LL << 20; break;
+                case 'G': unit = 1LL << 30; break;
+                default: break;
+                }
+            }
+            if (unit > 1) {
+                value.pop_back();
+            }
+            mMemoryMax = parse_number(value, 1, (1LL << 50) / unit, "memory limit") * unit;
+        } else {
+            throw InsaneException("Unknown resource limit '" + name + "'");
+        }
+    }
+    if ((mCpuMaxPercent > 0 || mMemoryMax > 0) && mCgroup.empty()) {
+        throw InsaneException("cpu-max and memory-max require a cgroup");
+    }
+}
+
+
+bool ResourceClass::empty() const noexcept
+{
+    return !mHasNice && mIoprio < 0 && !mHasCpus && mCgroup.empty();
+}
+
+
+std::string ResourceClass::spec() const
+{
+    return mSpec;
+}
+
+
+void ResourceClass::prepare()
+{
+    if (mCgroup.empty()) {
+        return;
+    }
+    if (mkdir(mCgroup.c_str(), 0755) < 0 && errno != EEXIST) {
+        throw InsaneException("Could not create cgroup '" + mCgroup + "': " + strerror(errno));
+    }
+    if (mCpuMaxPercent > 0) {
+        write_cgroup("cpu.max", std::to_string(mCpuMaxPercent * CPU_MAX_PERIOD_US / 100) + " " + std::to_string(CPU_MAX_PERIOD_US));
+    }
+    if (mMemoryMax > 0) {
+        write_cgroup("memory.max", std::to_string(mMemoryMax));
+    }
+    if (access(mProcsPath.c_str(), W_OK) < 0) {
+        throw InsaneException("Cannot move handlers into cgroup '" + mCgroup + "': " + strerror(errno));
+    }
+}
+
+
+void ResourceClass::apply() const noexcept
+{
+    // errors cannot be reported from here, prepare() checked what it could
+    if (!mProcsPath.empty()) {
+        int fd = open(mProcsPath.c_str(), O_WRONLY);
+        if (fd >= 0) {
+            // 0 moves the writing process
+            if (write(fd, "0", 1) < 0) {
+                // stays in the cgroup of the daemon
+            }
+            close(fd);
+        }
+    }
+    if (mHasNice) {
+        setpriority(PRIO_PROCESS, 0, mNice);
+    }
+#ifdef __linux__
+    if (mIoprio >= 0) {
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, mIoprio);
+    }
+    if (mHasCpus) {
+        sched_setaffinity(0, sizeof(mCpus), &mCpus);
+    }
+#endif
+}
+
+
+void ResourceClass::parse_cpus(const std::string & list)
+{
+#ifdef __linux__
+    CPU_ZERO(&mCpus);
+    std::istringstream in(list);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        auto pos = range.find('-');
+        long long first = parse_number(range.substr(0, pos), 0, CPU_SETSIZE - 1, "CPU");
+        long long last = pos == std::string::npos ? first : parse_number(range.substr(pos + 1), first, CPU_SETSIZE - 1, "CPU");
+        for (long long cpu = first; cpu <= last; ++cpu) {
+            CPU_SET(static_cast<int>(cpu), &mCpus);
+        }
+    }
+    if (CPU_COUNT(&mCpus) == 0) {
+        throw InsaneException("Invalid CPU list '" + list + "'");
+    }
+    mHasCpus = true;
+#else
+    throw InsaneException("CPU affinity is not supported on this system");
+#endif
+}
+
+
+void ResourceClass::write_cgroup(const std::string & name, const std::string & value)
+{
+    std::string path = mCgroup + "/" + name;
+    int fd = open(path.c_str(), O_WRONLY);
+    if (fd < 0) {
+        throw InsaneException("Could not open '" + path + "': " + strerror(errno)
+                              + " (is the controller enabled in cgroup.subtree_control of the parent?)");
+    }
+    ssize_t written = write(fd, value.data(), value.size());
+    int error = errno;
+    close(fd);
+    if (written != static_cast<ssize_t>(value.size())) {
+        throw InsaneException("Could not write '" + value + "' to '" + path + "': " + strerror(error));
+    }
+}
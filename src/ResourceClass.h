@@ -0,0 +1,123 @@
+/*
+ *  ResourceClass.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+
+#ifndef RESOURCECLASS_H
+#define RESOURCECLASS_H
+
+#include <string>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+
+/** Scheduling priority, I/O priority, CPU affinity and cgroup of event handler scripts.
+ *
+ * Parsed from a spec like "nice=10 ioprio=idle cpus=1-3", set up by the daemon with
+ * prepare() and applied by the forked child with apply() right before exec, so that
+ * handlers and everything they start (e.g. convert or tiff2pdf) cannot starve the poller.
+ * Optionally, handlers are moved into a cgroup v2 directory, whose cpu.max and
+ * memory.max limits are set by prepare(). The parent cgroup must have the cpu and
+ * memory controllers enabled in cgroup.subtree_control.
+ */
+class ResourceClass
+{
+public:
+    /** Constructor, no limits
+     */
+    ResourceClass();
+
+    /** Constructor
+     * @param spec space separated list of nice=-20..19, ioprio=idle|best-effort[:0-7]|realtime[:0-7],
+     *             cpus=LIST (e.g. 0,2-3), cgroup=DIR, cpu-max=PERCENT, memory-max=BYTES[K|M|G]
+     */
+    ResourceClass(const std::string & spec);
+
+    /**
+     * @return true iff no limits are set
+     */
+    bool empty() const noexcept;
+
+    /**
+     * @return spec the class was created from
+     */
+    std::string spec() const;
+
+    /**
+     * Create the cgroup and write its limits, if a cgroup is given
+     */
+    void prepare();
+
+    /**
+     * Apply the limits to the calling process. Only async-signal-safe calls are
+     * made, so it may be called in a child forked by a multi-threaded process.
+     */
+    void apply() const noexcept;
+
+private:
+    /// Spec as given
+    std::string mSpec;
+
+    /// Nice level, if mHasNice
+    int mNice = 0;
+
+    /// True iff the nice level should be set
+    bool mHasNice = false;
+
+    /// Encoded I/O priority, -1 to keep it
+    int mIoprio = -1;
+
+    /// True iff the CPU affinity should be set
+    bool mHasCpus = false;
+
+#ifdef __linux__
+    /// CPUs the handler may run on
+    cpu_set_t mCpus;
+#endif
+
+    /// Cgroup v2 directory, empty if none
+    std::string mCgroup;
+
+    /// Path of cgroup.procs in mCgroup
+    std::string mProcsPath;
+
+    /// CPU limit in percent of one CPU, 0 for no limit
+    long mCpuMaxPercent = 0;
+
+    /// Memory limit in bytes, 0 for no limit
+    long long mMemoryMax = 0;
+
+    /**
+     * Parse a CPU list, e.g. 0,2-3, into mCpus
+     * @param list
+     */
+    void parse_cpus(const std::string & list);
+
+    /**
+     * Write given value into a file of mCgroup
+     * @param name
+     * @param value
+     */
+    void write_cgroup(const std::string & name, const std::string & value);
+};
+
+#endif
@@ -0,0 +1,236 @@
+
+#include "SaneBackend.h"
+#include "InsaneException.h"
+#include "config.h"
+
+#include <dlfcn.h>
+#include <cstring>
+
+
+SaneBackend::SaneBackend()
+    : mInit(sane_init),
+      mExit(sane_exit),
+      mGetDevices(sane_get_devices),
+      mOpen(sane_open),
+      mClose(sane_close),
+      mGetOptionDescriptor(sane_get_option_descriptor),
+      mControlOption(sane_control_option),
+      mGetParameters(sane_get_parameters),
+      mStart(sane_start),
+      mRead(sane_read),
+      mCancel(sane_cancel)
+{
+}
+
+
+SaneBackend::~SaneBackend() noexcept
+{
+    if (mLibrary) {
+        dlclose(mLibrary);
+    }
+}
+
+
+void SaneBackend::load(const std::string & backend)
+{
+    if (mLibrary) {
+        throw InsaneException("Backend '" + mName + "' is already loaded");
+    }
+    if (backend.empty() || backend.find('/') != std::string::npos) {
+        throw InsaneException("Invalid backend name '" + backend + "'");
+    }
+
+    std::string errors;
+    for (auto & dir : backend_dirs()) {
+        std::string path = dir + "/libsane-" + backend + ".so.1";
+        mLibrary = dlopen(path.c_str(), RTLD_LAZY | RTLD_LOCAL);
+        if (mLibrary) {
+            mPath = path;
+            break;
+        }
+        errors += std::string("\n    ") + dlerror();
+    }
+    if (!mLibrary) {
+        throw InsaneException("Could not load backend '" + backend + "':" + errors);
+    }
+
+    mName = backend;
+    try {
+        mInit = reinterpret_cast<InitFunc>(resolve("init"));
+        mExit = reinterpret_cast<ExitFunc>(resolve("exit"));
+        mGetDevices = reinterpret_cast<GetDevicesFunc>(resolve("get_devices"));
+        mOpen = reinterpret_cast<OpenFunc>(resolve("open"));
+        mClose = reinterpret_cast<CloseFunc>(resolve("close"));
+        mGetOptionDescriptor = reinterpret_cast<GetOptionDescriptorFunc>(resolve("get_option_descriptor"));
+        mControlOption = reinterpret_cast<ControlOptionFunc>(resolve("control_option"));
+        mGetParameters = reinterpret_cast<GetParametersFunc>(resolve("get_parameters"));
+        mStart = reinterpret_cast<StartFunc>(resolve("start"));
+        mRead = reinterpret_cast<ReadFunc>(resolve("read"));
+        mCancel = reinterpret_cast<CancelFunc>(resolve("cancel"));
+    } catch (...) {
+        dlclose(mLibrary);
+        mLibrary = nullptr;
+        mName = "dll";
+        mPath = "";
+        throw;
+    }
+}
+
+
+std::string SaneBackend::name() const
+{
+    return mName;
+}
+
+
+std::string SaneBackend::path() const
+{
+    return mPath;
+}
+
+
+SANE_Status SaneBackend::init(SANE_Int * version_code, SANE_Auth_Callback authorize)
+{
+    return mInit(version_code, authorize);
+}
+
+
+void SaneBackend::exit()
+{
+    mExit();
+}
+
+
+SANE_Status SaneBackend::get_devices(const SANE_Device *** device_list, SANE_Bool local_only)
+{
+    if (!mLibrary) {
+        return mGetDevices(device_list, local_only);
+    }
+
+    const SANE_Device ** backend_list = nullptr;
+    SANE_Status status = mGetDevices(&backend_list, local_only);
+    if (status != SANE_STATUS_GOOD) {
+        return status;
+    }
+
+    // prefix device names with backend name, like dll does
+    mDeviceNames.clear();
+    mDevices.clear();
+    mDeviceList.clear();
+    for (int i = 0; backend_list && backend_list[i]; ++i) {
+        mDeviceNames.push_back(mName + ":" + backend_list[i]->name);
+        mDevices.push_back(*backend_list[i]);
+    }
+    for (size_t i = 0; i < mDevices.size(); ++i) {
+        mDevices[i].name = mDeviceNames[i].c_str();
+        mDeviceList.push_back(&mDevices[i]);
+    }
+    mDeviceList.push_back(nullptr);
+    *device_list = mDeviceList.data();
+    return status;
+}
+
+
+SANE_Status SaneBackend::open(SANE_String_Const name, SANE_Handle * handle)
+{
+    if (mLibrary) {
+        // strip the backend prefix added by get_devices() or given by the user
+        std::string prefix = mName + ":";
+        if (strncmp(name, prefix.c_str(), prefix.size()) == 0) {
+            name += prefix.size();
+        } else if (strcmp(name, mName.c_str()) == 0) {
+            // just the backend name, open its first device
+            name += mName.size();
+        }
+    }
+    return mOpen(name, handle);
+}
+
+
+void SaneBackend::close(SANE_Handle handle)
+{
+    mClose(handle);
+}
+
+
+const SANE_Option_Descriptor * SaneBackend::get_option_descriptor(SANE_Handle handle, SANE_Int option)
+{
+    return mGetOptionDescriptor(handle, option);
+}
+
+
+SANE_Status SaneBackend::control_option(SANE_Handle handle, SANE_Int option, SANE_Action action, void * value, SANE_Int * info)
+{
+    return mControlOption(handle, option, action, value, info);
+}
+
+
+SANE_Status SaneBackend::get_parameters(SANE_Handle handle, SANE_Parameters * params)
+{
+    return mGetParameters(handle, params);
+}
+
+
+SANE_Status SaneBackend::start(SANE_Handle handle)
+{
+    return mStart(handle);
+}
+
+
+SANE_Status SaneBackend::read(SANE_Handle handle, SANE_Byte * data, SANE_Int max_length, SANE_Int * length)
+{
+    return mRead(handle, data, max_length, length);
+}
+
+
+void SaneBackend::cancel(SANE_Handle handle)
+{
+    mCancel(handle);
+}
+
+
+void * SaneBackend::resolve(const std::string & function)
+{
+    // backend names may contain dashes, the entry points use underscores instead
+    std::string symbol = "sane_" + mName + "_" + function;
+    for (auto & c : symbol) {
+        if (c == '-') {
+            c = '_';
+        }
+    }
+    void * address = dlsym(mLibrary, symbol.c_str());
+    if (!address) {
+        throw InsaneException("Backend '" + mName + "' has no entry point " + symbol);
+    }
+    return address;
+}
+
+
+std::vector<std::string> SaneBackend::backend_dirs()
+{
+    std::vector<std::string> dirs;
+
+    // backends are normally installed next to libsane
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void *>(&sane_init), &info) && info.dli_fname) {
+        std::string lib = info.dli_fname;
+        auto pos = lib.rfind('/');
+        if (pos != std::string::npos) {
+            dirs.push_back(lib.substr(0, pos) + "/sane");
+        }
+    }
+
+    std::string configured = SANE_BACKEND_DIRS;
+    size_t start = 0;
+    while (start <= configured.size()) {
+        size_t end = configured.find(':', start);
+        if (end == std::string::npos) {
+            end = configured.size();
+        }
+        if (end > start) {
+            dirs.push_back(configured.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return dirs;
+}
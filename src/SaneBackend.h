@@ -0,0 +1,149 @@
+/*
+ *  SaneBackend.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+#ifndef SANEBACKEND_H
+#define SANEBACKEND_H
+
+#include <string>
+#include <vector>
+
+#include <sane/sane.h>
+
+
+/** Entry points of a SANE backend.
+ *
+ * By default, all calls go to the linked libsane, which is the dll
+ * meta-backend that loads and probes every backend from dll.conf. After
+ * load(), the calls go directly to a single backend shared object instead,
+ * and device names are prefixed with the backend name the same way dll
+ * does it, so they stay interchangeable.
+ */
+class SaneBackend
+{
+public:
+    /** Constructor, uses the linked libsane
+     */
+    SaneBackend();
+
+    /** Destructor, unloads the backend
+     */
+    ~SaneBackend() noexcept;
+
+    /**
+     * Load given backend (e.g. "genesys") and bypass the dll meta-backend.
+     * Must be called before init().
+     * @param backend
+     */
+    void load(const std::string & backend);
+
+    /**
+     * @return name of the loaded backend, or "dll" if the linked libsane is used
+     */
+    std::string name() const;
+
+    /**
+     * @return file name of the loaded backend, or empty string if the linked libsane is used
+     */
+    std::string path() const;
+
+    SANE_Status init(SANE_Int * version_code, SANE_Auth_Callback authorize);
+
+    void exit();
+
+    SANE_Status get_devices(const SANE_Device *** device_list, SANE_Bool local_only);
+
+    SANE_Status open(SANE_String_Const name, SANE_Handle * handle);
+
+    void close(SANE_Handle handle);
+
+    const SANE_Option_Descriptor * get_option_descriptor(SANE_Handle handle, SANE_Int option);
+
+    SANE_Status control_option(SANE_Handle handle, SANE_Int option, SANE_Action action, void * value, SANE_Int * info);
+
+    SANE_Status get_parameters(SANE_Handle handle, SANE_Parameters * params);
+
+    SANE_Status start(SANE_Handle handle);
+
+    SANE_Status read(SANE_Handle handle, SANE_Byte * data, SANE_Int max_length, SANE_Int * length);
+
+    void cancel(SANE_Handle handle);
+
+private:
+    typedef SANE_Status (*InitFunc)(SANE_Int *, SANE_Auth_Callback);
+    typedef void (*ExitFunc)();
+    typedef SANE_Status (*GetDevicesFunc)(const SANE_Device ***, SANE_Bool);
+    typedef SANE_Status (*OpenFunc)(SANE_String_Const, SANE_Handle *);
+    typedef void (*CloseFunc)(SANE_Handle);
+    typedef const SANE_Option_Descriptor * (*GetOptionDescriptorFunc)(SANE_Handle, SANE_Int);
+    typedef SANE_Status (*ControlOptionFunc)(SANE_Handle, SANE_Int, SANE_Action, void *, SANE_Int *);
+    typedef SANE_Status (*GetParametersFunc)(SANE_Handle, SANE_Parameters *);
+    typedef SANE_Status (*StartFunc)(SANE_Handle);
+    typedef SANE_Status (*ReadFunc)(SANE_Handle, SANE_Byte *, SANE_Int, SANE_Int *);
+    typedef void (*CancelFunc)(SANE_Handle);
+
+    /// Handle returned by dlopen, nullptr if the linked libsane is used
+    void * mLibrary = nullptr;
+
+    /// Backend name
+    std::string mName = "dll";
+
+    /// Backend file name
+    std::string mPath = "";
+
+    InitFunc mInit;
+    ExitFunc mExit;
+    GetDevicesFunc mGetDevices;
+    OpenFunc mOpen;
+    CloseFunc mClose;
+    GetOptionDescriptorFunc mGetOptionDescriptor;
+    ControlOptionFunc mControlOption;
+    GetParametersFunc mGetParameters;
+    StartFunc mStart;
+    ReadFunc mRead;
+    CancelFunc mCancel;
+
+    /// Prefixed device names returned by get_devices()
+    std::vector<std::string> mDeviceNames;
+
+    /// Devices returned by get_devices()
+    std::vector<SANE_Device> mDevices;
+
+    /// Null terminated device list returned by get_devices()
+    std::vector<const SANE_Device *> mDeviceList;
+
+    // Forbid copy
+    SaneBackend(const SaneBackend &);
+    SaneBackend & operator=(const SaneBackend &);
+
+    /**
+     * Resolve entry point sane_<backend>_<function> of the loaded backend
+     * @param function
+     * @return address of the entry point
+     */
+    void * resolve(const std::string & function);
+
+    /**
+     * @return directories to search for backends in
+     */
+    static std::vector<std::string> backend_dirs();
+};
+
+#endif
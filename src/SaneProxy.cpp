@@ -0,0 +1,679 @@
+
+#include "SaneProxy.h"
+#include "InsaneException.h"
+#include "Timer.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+
+namespace {
+
+/// Remote procedure calls of the SANE network protocol
+enum Rpc : SANE_Word {
+    NET_INIT = 0,
+    NET_GET_DEVICES,
+    NET_OPEN,
+    NET_CLOSE,
+    NET_GET_OPTION_DESCRIPTORS,
+    NET_CONTROL_OPTION,
+    NET_GET_PARAMETERS,
+    NET_START,
+    NET_CANCEL,
+    NET_AUTHORIZE,
+    NET_EXIT
+};
+
+/// Version of the network protocol, encoded as build number of the version code
+const SANE_Word PROTOCOL_VERSION = 3;
+
+/// Byte order markers sent with the scan data port
+const SANE_Word NET_LITTLE_ENDIAN = 0x1234;
+const SANE_Word NET_BIG_ENDIAN = 0x4321;
+
+/// Marks the end of the scan data, followed by a status byte
+const uint32_t DATA_END = 0xffffffff;
+
+/// The only handle given to clients
+const SANE_Word HANDLE = 0;
+
+/// Largest accepted string or option value
+const SANE_Word MAX_VALUE_SIZE = 65536;
+
+/// Largest number of options sent to a client
+const SANE_Int MAX_OPTIONS = 10000;
+
+/// Maximal time to wait for the rest of a request or for the data connection
+const int IO_TIMEOUT_MS = 10000;
+
+/// Longest pause between requests while a client has the device open
+const int IDLE_TIMEOUT_MS = 60000;
+
+/// Interval of checking whether the proxy should stop
+const int STOP_CHECK_MS = 200;
+
+/// Size of the scan data buffer
+const SANE_Int READ_SIZE = 65536;
+
+
+/**
+ * Wait until fd is readable
+ * @return false on timeout
+ */
+bool wait_readable(int fd, int timeout_ms) noexcept
+{
+    pollfd pfd = {fd, POLLIN, 0};
+    int ret;
+    do {
+        ret = ::poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+    return ret > 0;
+}
+
+
+void receive(int fd, void * buf, size_t size)
+{
+    char * p = static_cast<char *>(buf);
+    while (size > 0) {
+        if (!wait_readable(fd, IO_TIMEOUT_MS)) {
+            throw InsaneException("saned client timed out");
+        }
+        ssize_t len = recv(fd, p, size, 0);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            throw InsaneException("saned client disconnected");
+        }
+        p += len;
+        size -= static_cast<size_t>(len);
+    }
+}
+
+
+void send_all(int fd, const std::string & data)
+{
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t len = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len < 0) {
+            throw InsaneException(std::string("Could not send to saned client: ") + strerror(errno));
+        }
+        sent += static_cast<size_t>(len);
+    }
+}
+
+
+SANE_Word get_word(int fd)
+{
+    uint32_t word;
+    receive(fd, &word, sizeof(word));
+    return static_cast<SANE_Word>(ntohl(word));
+}
+
+
+/**
+ * Read a string, a null string is returned as empty string
+ */
+std::string get_string(int fd)
+{
+    SANE_Word len = get_word(fd);
+    if (len < 0 || len > MAX_VALUE_SIZE) {
+        throw InsaneException("saned client sent invalid string length " + std::to_string(len));
+    }
+    std::string s(static_cast<size_t>(len), '\0');
+    if (len > 0) {
+        receive(fd, &s[0], s.size());
+    }
+    // strip the terminating null character
+    return std::string(s.c_str());
+}
+
+
+void put_word(std::string & out, SANE_Word word)
+{
+    uint32_t w = htonl(static_cast<uint32_t>(word));
+    out.append(reinterpret_cast<const char *>(&w), sizeof(w));
+}
+
+
+void put_string(std::string & out, const char * s)
+{
+    if (!s) {
+        put_word(out, 0);
+        return;
+    }
+    size_t len = strlen(s) + 1;
+    put_word(out, static_cast<SANE_Word>(len));
+    out.append(s, len);
+}
+
+
+/**
+ * Encode an option descriptor pointer
+ */
+void put_descriptor(std::string & out, const SANE_Option_Descriptor * opt)
+{
+    put_word(out, 0);
+    put_string(out, opt->name);
+    put_string(out, opt->title);
+    put_string(out, opt->desc);
+    put_word(out, opt->type);
+    put_word(out, opt->unit);
+    put_word(out, opt->size);
+    put_word(out, opt->cap);
+    switch (opt->constraint_type) {
+    case SANE_CONSTRAINT_RANGE:
+        put_word(out, opt->constraint_type);
+        if (!opt->constraint.range) {
+            put_word(out, 1);
+            break;
+        }
+        put_word(out, 0);
+        put_word(out, opt->constraint.range->min);
+        put_word(out, opt->constraint.range->max);
+        put_word(out, opt->constraint.range->quant);
+        break;
+    case SANE_CONSTRAINT_WORD_LIST:
+        put_word(out, opt->constraint_type);
+        if (!opt->constraint.word_list) {
+            put_word(out, 0);
+            break;
+        }
+        // the first word is the number of the following ones
+        put_word(out, opt->constraint.word_list[0] + 1);
+        for (SANE_Int i = 0; i <= opt->constraint.word_list[0]; ++i) {
+            put_word(out, opt->constraint.word_list[i]);
+        }
+        break;
+    case SANE_CONSTRAINT_STRING_LIST: {
+        put_word(out, opt->constraint_type);
+        SANE_Word count = 0;
+        while (opt->constraint.string_list && opt->constraint.string_list[count]) {
+            count++;
+        }
+        // including the terminating null string
+        put_word(out, count + 1);
+        for (SANE_Word i = 0; i < count; ++i) {
+            put_string(out, opt->constraint.string_list[i]);
+        }
+        put_string(out, nullptr);
+        break;
+    }
+    default:
+        put_word(out, SANE_CONSTRAINT_NONE);
+        break;
+    }
+}
+
+
+/**
+ * @return number of array elements of an option value of given type and size
+ */
+SANE_Word value_length(SANE_Word type, SANE_Word size) noexcept
+{
+    switch (type) {
+    case SANE_TYPE_BOOL:
+    case SANE_TYPE_INT:
+    case SANE_TYPE_FIXED:
+        return size / static_cast<SANE_Word>(sizeof(SANE_Word));
+    case SANE_TYPE_STRING:
+        return size;
+    default:
+        return 0;
+    }
+}
+
+
+/**
+ * Block all signals while starting a thread, so that they interrupt the main thread
+ */
+std::thread start_thread(std::function<void()> func)
+{
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    std::thread thread;
+    try {
+        thread = std::thread(func);
+    } catch (...) {
+        pthread_sigmask(SIG_SETMASK, &old, nullptr);
+        throw;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    return thread;
+}
+
+}
+
+
+const int SaneProxy::DEFAULT_PORT = 6566;
+
+
+SaneProxy::SaneProxy(SaneBackend & sane, std::mutex & lock)
+    : mSane(sane),
+      mLock(lock)
+{
+}
+
+
+SaneProxy::~SaneProxy() noexcept
+{
+    stop();
+}
+
+
+void SaneProxy::set_functions(DeviceFunc device, InitFunc init, LogFunc log)
+{
+    mDevice = device;
+    mInit = init;
+    mLog = log;
+}
+
+
+void SaneProxy::start(int port)
+{
+    stop();
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw InsaneException(std::string("Could not create saned socket: ") + strerror(errno));
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    // never reachable from other hosts
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        std::string err = strerror(errno);
+        ::close(fd);
+        throw InsaneException("Could not listen on port " + std::to_string(port) + " of localhost: " + err);
+    }
+    mSocket = fd;
+    mRun = true;
+    try {
+        mThread = start_thread([this]() { serve(); });
+    } catch (...) {
+        mRun = false;
+        ::close(mSocket);
+        mSocket = -1;
+        throw;
+    }
+}
+
+
+void SaneProxy::stop() noexcept
+{
+    mRun = false;
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+    if (mSocket >= 0) {
+        ::close(mSocket);
+        mSocket = -1;
+    }
+}
+
+
+bool SaneProxy::in_use() const noexcept
+{
+    return mInUse;
+}
+
+
+long SaneProxy::sessions() const noexcept
+{
+    return mSessions;
+}
+
+
+bool SaneProxy::take_reload() noexcept
+{
+    return mReload.exchange(false);
+}
+
+
+void SaneProxy::serve() noexcept
+{
+    while (mRun) {
+        if (!wait_readable(mSocket, STOP_CHECK_MS)) {
+            continue;
+        }
+        int fd = accept(mSocket, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        mSessions++;
+        try {
+            mLog("saned client connected", 2);
+            session(fd);
+            mLog("saned client disconnected", 2);
+        } catch (InsaneException & e) {
+            mLog(e.what(), 1);
+        } catch (std::exception & e) {
+            mLog(std::string("saned session failed: ") + e.what(), 0);
+        }
+        ::close(fd);
+    }
+}
+
+
+void SaneProxy::session(int fd)
+{
+    SANE_Handle handle = nullptr;
+    std::unique_lock<std::mutex> lock(mLock, std::defer_lock);
+
+    auto release = [&]() {
+        if (handle) {
+            mSane.cancel(handle);
+            mSane.close(handle);
+            handle = nullptr;
+        }
+        if (lock.owns_lock()) {
+            lock.unlock();
+        }
+        mInUse = false;
+    };
+    auto check_handle = [&](SANE_Word h) {
+        if (h != HANDLE || !handle) {
+            throw InsaneException("saned client used invalid handle " + std::to_string(h));
+        }
+    };
+
+    try {
+        long long last_request_us = Timer::monotonic_us();
+        while (mRun) {
+            if (!wait_readable(fd, STOP_CHECK_MS)) {
+                // a forgotten client must not keep the daemon from polling forever
+                if (handle && Timer::monotonic_us() - last_request_us > IDLE_TIMEOUT_MS * 1000LL) {
+                    throw InsaneException("saned client was idle for " + std::to_string(IDLE_TIMEOUT_MS / 1000)
+                                          + " s, closing the device");
+                }
+                continue;
+            }
+            last_request_us = Timer::monotonic_us();
+            std::string reply;
+            SANE_Word rpc = get_word(fd);
+            switch (rpc) {
+            case NET_INIT:
+                get_word(fd);
+                get_string(fd);
+                put_word(reply, SANE_STATUS_GOOD);
+                put_word(reply, SANE_VERSION_CODE(SANE_CURRENT_MAJOR, 0, PROTOCOL_VERSION));
+                break;
+            case NET_GET_DEVICES: {
+                std::string device;
+                if (lock.owns_lock()) {
+                    device = mDevice();
+                } else {
+                    std::lock_guard<std::mutex> guard(mLock);
+                    device = mDevice();
+                }
+                // only the polled device, asking the backends could end up asking ourselves through the net backend
+                put_word(reply, SANE_STATUS_GOOD);
+                put_word(reply, device.empty() ? 1 : 2);
+                if (!device.empty()) {
+                    put_word(reply, 0);
+                    put_string(reply, device.c_str());
+                    put_string(reply, "insaned");
+                    put_string(reply, "shared device");
+                    put_string(reply, "scanner");
+                }
+                put_word(reply, 1);
+                break;
+            }
+            case NET_OPEN: {
+                std::string name = get_string(fd);
+                SANE_Status status = SANE_STATUS_DEVICE_BUSY;
+                if (!handle) {
+                    // stop polling before waiting for the current poll to finish
+                    mInUse = true;
+                    lock.lock();
+                    std::string device = mDevice();
+                    if (name.empty()) {
+                        name = device;
+                    }
+                    if (name.empty() || name != device) {
+                        status = SANE_STATUS_INVAL;
+                    } else {
+                        mInit();
+                        status = mSane.open(name.c_str(), &handle);
+                    }
+                    if (status != SANE_STATUS_GOOD) {
+                        handle = nullptr;
+                        release();
+                    }
+                    mLog("saned client opened '" + name + "': " + sane_strstatus(status), 2);
+                }
+                put_word(reply, status);
+                put_word(reply, HANDLE);
+                put_string(reply, nullptr);
+                break;
+            }
+            case NET_CLOSE:
+                check_handle(get_word(fd));
+                release();
+                put_word(reply, 0);
+                break;
+            case NET_GET_OPTION_DESCRIPTORS: {
+                check_handle(get_word(fd));
+                std::vector<const SANE_Option_Descriptor *> options;
+                while (static_cast<SANE_Int>(options.size()) < MAX_OPTIONS) {
+                    const SANE_Option_Descriptor * opt = mSane.get_option_descriptor(handle, static_cast<SANE_Int>(options.size()));
+                    if (!opt) {
+                        break;
+                    }
+                    options.push_back(opt);
+                }
+                put_word(reply, static_cast<SANE_Word>(options.size()));
+                for (auto opt : options) {
+                    put_descriptor(reply, opt);
+                }
+                break;
+            }
+            case NET_CONTROL_OPTION: {
+                check_handle(get_word(fd));
+                SANE_Int option = get_word(fd);
+                SANE_Action action = static_cast<SANE_Action>(get_word(fd));
+                SANE_Word type = SANE_TYPE_BOOL;
+                SANE_Word size = 0;
+                std::vector<char> value;
+                if (action != SANE_ACTION_SET_AUTO) {
+                    type = get_word(fd);
+                    size = get_word(fd);
+                    SANE_Word len = get_word(fd);
+                    if (size < 0 || size > MAX_VALUE_SIZE || len < 0 || len > MAX_VALUE_SIZE) {
+                        throw InsaneException("saned client sent invalid option value size");
+                    }
+                    value.assign(static_cast<size_t>(size) + sizeof(SANE_Word) * static_cast<size_t>(len) + 1, '\0');
+                    for (SANE_Word i = 0; i < len; ++i) {
+                        if (type == SANE_TYPE_STRING) {
+                            receive(fd, &value[static_cast<size_t>(i)], 1);
+                        } else if (type == SANE_TYPE_BOOL || type == SANE_TYPE_INT || type == SANE_TYPE_FIXED) {
+                            SANE_Word word = get_word(fd);
+                            memcpy(&value[static_cast<size_t>(i) * sizeof(SANE_Word)], &word, sizeof(word));
+                        }
+                    }
+                }
+                // the backend reads and writes as many bytes as the descriptor says, whatever the client sent
+                const SANE_Option_Descriptor * opt = mSane.get_option_descriptor(handle, option);
+                SANE_Int info = 0;
+                SANE_Status status = SANE_STATUS_INVAL;
+                if (!opt || opt->size < 0 || opt->size > MAX_VALUE_SIZE) {
+                    mLog("saned client used invalid option " + std::to_string(option), 1);
+                } else if (action != SANE_ACTION_SET_AUTO && opt->type != type) {
+                    mLog("saned client used wrong type for option " + std::to_string(option), 1);
+                } else {
+                    if (!value.empty() && value.size() < static_cast<size_t>(opt->size)) {
+                        value.resize(static_cast<size_t>(opt->size), '\0');
+                    }
+                    status = mSane.control_option(handle, option, action, value.empty() ? nullptr : value.data(), &info);
+                }
+                if (info & SANE_INFO_RELOAD_OPTIONS) {
+                    // the sensors of the daemon may have moved as well
+                    mReload = true;
+                }
+                put_word(reply, status);
+                put_word(reply, info);
+                put_word(reply, type);
+                put_word(reply, size);
+                SANE_Word len = value_length(type, size);
+                put_word(reply, len);
+                for (SANE_Word i = 0; i < len; ++i) {
+                    if (type == SANE_TYPE_STRING) {
+                        reply += value[static_cast<size_t>(i)];
+                    } else {
+                        SANE_Word word;
+                        memcpy(&word, &value[static_cast<size_t>(i) * sizeof(SANE_Word)], sizeof(word));
+                        put_word(reply, word);
+                    }
+                }
+                put_string(reply, nullptr);
+                break;
+            }
+            case NET_GET_PARAMETERS: {
+                check_handle(get_word(fd));
+                SANE_Parameters params;
+                memset(&params, 0, sizeof(params));
+                put_word(reply, mSane.get_parameters(handle, &params));
+                put_word(reply, params.format);
+                put_word(reply, params.last_frame);
+                put_word(reply, params.bytes_per_line);
+                put_word(reply, params.pixels_per_line);
+                put_word(reply, params.lines);
+                put_word(reply, params.depth);
+                break;
+            }
+            case NET_START:
+                check_handle(get_word(fd));
+                scan(fd, handle);
+                break;
+            case NET_CANCEL:
+                check_handle(get_word(fd));
+                mSane.cancel(handle);
+                put_word(reply, 0);
+                break;
+            case NET_AUTHORIZE:
+                get_string(fd);
+                get_string(fd);
+                get_string(fd);
+                put_word(reply, 0);
+                break;
+            case NET_EXIT:
+                release();
+                return;
+            default:
+                throw InsaneException("saned client sent unknown request " + std::to_string(rpc));
+            }
+            send_all(fd, reply);
+        }
+    } catch (...) {
+        release();
+        throw;
+    }
+    release();
+}
+
+
+void SaneProxy::scan(int fd, SANE_Handle handle)
+{
+    // image data is sent over a second connection to a port given in the reply
+    int data_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (data_socket < 0) {
+        throw InsaneException(std::string("Could not create saned data socket: ") + strerror(errno));
+    }
+    fcntl(data_socket, F_SETFD, FD_CLOEXEC);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    if (bind(data_socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(data_socket, 1) < 0
+            || getsockname(data_socket, reinterpret_cast<sockaddr *>(&addr), &addr_len) < 0) {
+        std::string err = strerror(errno);
+        ::close(data_socket);
+        throw InsaneException("Could not listen for saned data connection: " + err);
+    }
+
+    SANE_Status status = mSane.start(handle);
+    uint16_t probe = 1;
+    std::string reply;
+    put_word(reply, status);
+    put_word(reply, status == SANE_STATUS_GOOD ? ntohs(addr.sin_port) : 0);
+    put_word(reply, *reinterpret_cast<uint8_t *>(&probe) == 1 ? NET_LITTLE_ENDIAN : NET_BIG_ENDIAN);
+    put_string(reply, nullptr);
+    try {
+        send_all(fd, reply);
+    } catch (...) {
+        ::close(data_socket);
+        throw;
+    }
+    if (status != SANE_STATUS_GOOD) {
+        ::close(data_socket);
+        return;
+    }
+
+    int data = wait_readable(data_socket, IO_TIMEOUT_MS) ? accept(data_socket, nullptr, nullptr) : -1;
+    ::close(data_socket);
+    if (data < 0) {
+        mSane.cancel(handle);
+        throw InsaneException("saned client did not open the data connection");
+    }
+    fcntl(data, F_SETFD, FD_CLOEXEC);
+
+    std::vector<SANE_Byte> buf(static_cast<size_t>(READ_SIZE));
+    bool cancelled = false;
+    try {
+        for (;;) {
+            // the only request expected during a scan is a cancel, it is answered afterwards
+            if (!cancelled && wait_readable(fd, 0)) {
+                cancelled = true;
+                mSane.cancel(handle);
+            }
+            SANE_Int len = 0;
+            status = mSane.read(handle, buf.data(), READ_SIZE, &len);
+            if (status != SANE_STATUS_GOOD) {
+                std::string end;
+                put_word(end, static_cast<SANE_Word>(DATA_END));
+                end += static_cast<char>(status);
+                send_all(data, end);
+                break;
+            }
+            if (len > 0) {
+                std::string record;
+                put_word(record, len);
+                record.append(reinterpret_cast<const char *>(buf.data()), static_cast<size_t>(len));
+                send_all(data, record);
+            }
+        }
+    } catch (InsaneException &) {
+        // the client closed the data connection
+        mSane.cancel(handle);
+    }
+    ::close(data);
+}
@@ -0,0 +1,159 @@
+/*
+ *  SaneProxy.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+
+#ifndef SANEPROXY_H
+#define SANEPROXY_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "SaneBackend.h"
+
+
+/** Minimal saned on the loopback interface.
+ *
+ * Serves the SANE network protocol for the device polled by the daemon, so
+ * that event handler scripts can scan through the net backend (e.g.
+ * scanimage -d net:localhost:genesys:libusb:001:003) without loading and
+ * initializing all backends again. One client is served at a time, in a
+ * separate thread. While a client has the device open, it holds the device
+ * lock, which keeps the daemon from polling the sensors, until it closes the
+ * device or stays idle for too long. Any local user may connect.
+ */
+class SaneProxy
+{
+public:
+    /// Port of saned
+    static const int DEFAULT_PORT;
+
+    /// Function returning the name of the served device, called with the device lock held
+    typedef std::function<std::string()> DeviceFunc;
+
+    /// Function making sure SANE is initialized, called with the device lock held
+    typedef std::function<void()> InitFunc;
+
+    /// Function logging a message with given verbosity
+    typedef std::function<void(const std::string &, int)> LogFunc;
+
+    /** Constructor
+     * @param sane SANE entry points shared with the daemon
+     * @param lock device lock shared with the daemon
+     */
+    SaneProxy(SaneBackend & sane, std::mutex & lock);
+
+    /** Destructor, stops serving
+     */
+    ~SaneProxy() noexcept;
+
+    /**
+     * Set functions called by the serving thread
+     * @param device
+     * @param init
+     * @param log
+     */
+    void set_functions(DeviceFunc device, InitFunc init, LogFunc log);
+
+    /**
+     * Listen on given port of the loopback interface and start serving
+     * @param port
+     */
+    void start(int port);
+
+    /**
+     * Disconnect the client and stop serving
+     */
+    void stop() noexcept;
+
+    /**
+     * @return true iff a client has the device open or is about to open it
+     */
+    bool in_use() const noexcept;
+
+    /**
+     * @return number of served sessions
+     */
+    long sessions() const noexcept;
+
+    /**
+     * @return true iff a client changed an option that made the backend reload its options
+     *         since the last call
+     */
+    bool take_reload() noexcept;
+
+private:
+    /// SANE entry points
+    SaneBackend & mSane;
+
+    /// Held while a client has the device open
+    std::mutex & mLock;
+
+    DeviceFunc mDevice;
+
+    InitFunc mInit;
+
+    LogFunc mLog;
+
+    /// Listening socket
+    int mSocket = -1;
+
+    /// Serving thread
+    std::thread mThread;
+
+    /// Serving thread runs while true
+    std::atomic<bool> mRun{false};
+
+    /// True while a client has the device open
+    std::atomic<bool> mInUse{false};
+
+    /// Number of served sessions
+    std::atomic<long> mSessions{0};
+
+    /// Set when the backend asks a client to reload the options
+    std::atomic<bool> mReload{false};
+
+    // Forbid copy
+    SaneProxy(const SaneProxy &);
+    SaneProxy & operator=(const SaneProxy &);
+
+    /**
+     * Serving thread, accepts one client after another
+     */
+    void serve() noexcept;
+
+    /**
+     * Handle requests of a connected client until it disconnects
+     * @param fd
+     */
+    void session(int fd);
+
+    /**
+     * Start the scan and send image data over a separate connection
+     * @param fd control connection
+     * @param handle
+     */
+    void scan(int fd, SANE_Handle handle);
+};
+
+#endif
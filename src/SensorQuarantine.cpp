@@ -0,0 +1,137 @@
+
+#include "SensorQuarantine.h"
+
+#include <algorithm>
+
+
+const int SensorQuarantine::STUCK_MS = 10000;
+const int SensorQuarantine::FLAP_WINDOW_MS = 10000;
+const int SensorQuarantine::FLAP_TOGGLES = 20;
+const int SensorQuarantine::RECHECK_MS = 5000;
+const int SensorQuarantine::RECHECK_MAX_MS = 600000;
+
+
+SensorQuarantine::SensorQuarantine()
+{
+}
+
+
+std::vector<std::string> SensorQuarantine::feed(long long time_us, const Sensors & sensors, const Changes & changes)
+{
+    std::vector<std::string> result;
+    for (auto & entry : sensors) {
+        auto it = mSensors.find(entry.first);
+        if (it == mSensors.end()) {
+            // a button held at startup is timed from the first sample
+            Sensor & sensor = mSensors[entry.first];
+            sensor.on = entry.second;
+            sensor.changed_us = time_us;
+            continue;
+        }
+        Sensor & sensor = it->second;
+        if (entry.second != sensor.on) {
+            sensor.on = entry.second;
+            changed(sensor, time_us);
+        }
+    }
+    for (auto & entry : changes) {
+        changed(mSensors[entry.first], time_us);
+    }
+    for (auto & entry : mSensors) {
+        if (check(entry.second, time_us)) {
+            result.push_back(entry.first);
+        }
+    }
+    return result;
+}
+
+
+SensorQuarantine::State SensorQuarantine::state(const std::string & name) const noexcept
+{
+    auto it = mSensors.find(name);
+    return it == mSensors.end() ? NORMAL : it->second.state;
+}
+
+
+bool SensorQuarantine::any() const noexcept
+{
+    return mQuarantined > 0;
+}
+
+
+long SensorQuarantine::quarantines() const noexcept
+{
+    return mQuarantines;
+}
+
+
+std::string SensorQuarantine::summary(long long now_us) const
+{
+    std::string result;
+    for (auto & entry : mSensors) {
+        const Sensor & sensor = entry.second;
+        if (sensor.state == NORMAL) {
+            continue;
+        }
+        result += (result.empty() ? "" : ", ") + entry.first + " " + state_name(sensor.state)
+            + " for " + std::to_string((now_us - sensor.since_us) / 1000000) + " s, next check in "
+            + std::to_string(std::max(0LL, sensor.recheck_us - now_us) / 1000000) + " s";
+    }
+    return result;
+}
+
+
+const char * SensorQuarantine::state_name(State state) noexcept
+{
+    switch (state) {
+    case NORMAL:
+        return "normal";
+    case STUCK:
+        return "stuck";
+    case FLAPPING:
+        return "flapping";
+    }
+    return "unknown";
+}
+
+
+void SensorQuarantine::changed(Sensor & sensor, long long time_us)
+{
+    sensor.changed_us = time_us;
+    sensor.changes.push_back(time_us);
+}
+
+
+bool SensorQuarantine::check(Sensor & sensor, long long time_us)
+{
+    while (!sensor.changes.empty() && time_us - sensor.changes.front() > FLAP_WINDOW_MS * 1000LL) {
+        sensor.changes.pop_front();
+    }
+    bool stuck = sensor.on && time_us - sensor.changed_us >= STUCK_MS * 1000LL;
+    bool flapping = sensor.changes.size() >= static_cast<size_t>(FLAP_TOGGLES);
+
+    if (sensor.state == NORMAL) {
+        if (!stuck && !flapping) {
+            return false;
+        }
+        sensor.state = stuck ? STUCK : FLAPPING;
+        sensor.since_us = time_us;
+        sensor.backoff_us = RECHECK_MS * 1000LL;
+        sensor.recheck_us = time_us + sensor.backoff_us;
+        mQuarantined++;
+        mQuarantines++;
+        return true;
+    }
+    if (time_us < sensor.recheck_us) {
+        return false;
+    }
+    if (!sensor.on && !flapping) {
+        sensor.state = NORMAL;
+        sensor.changes.clear();
+        mQuarantined--;
+        return true;
+    }
+    sensor.backoff_us = std::min(sensor.backoff_us * 2, RECHECK_MAX_MS * 1000LL);
+    sensor.recheck_us = time_us + sensor.backoff_us;
+    return false;
+}
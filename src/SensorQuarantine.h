@@ -0,0 +1,159 @@
+/*
+ *  SensorQuarantine.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+
+#ifndef SENSORQUARANTINE_H
+#define SENSORQUARANTINE_H
+
+#include <deque>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/** Detects sensors that cannot be operated by a human.
+ *
+ * A button that stays pressed for longer than STUCK_MS or a sensor that
+ * changes more than FLAP_TOGGLES times within FLAP_WINDOW_MS is put into
+ * quarantine. It is checked again after RECHECK_MS, and then twice as
+ * long each time, up to RECHECK_MAX_MS. It is released at the first check
+ * where it is not pressed and has calmed down.
+ */
+class SensorQuarantine
+{
+public:
+    /// Sampled buttons, as in SensorSample
+    typedef std::vector<std::pair<std::string, bool>> Sensors;
+
+    /// Changed values of other sensors, as in SensorSample
+    typedef std::vector<std::pair<std::string, std::string>> Changes;
+
+    /// Sensor states
+    enum State : int {
+        /// Sensor behaves normally
+        NORMAL = 0,
+        /// Button is pressed for too long
+        STUCK,
+        /// Sensor changes too often
+        FLAPPING
+    };
+
+    /// Longest plausible press in ms
+    static const int STUCK_MS;
+
+    /// Window in ms to count changes in
+    static const int FLAP_WINDOW_MS;
+
+    /// Number of changes within FLAP_WINDOW_MS that no human can produce
+    static const int FLAP_TOGGLES;
+
+    /// Time in ms until the first check of a quarantined sensor
+    static const int RECHECK_MS;
+
+    /// Longest time in ms between two checks
+    static const int RECHECK_MAX_MS;
+
+    /** Constructor
+     */
+    SensorQuarantine();
+
+    /**
+     * Process a sample
+     * @param time_us monotonic time of the sample
+     * @param sensors button states, empty if the poll failed
+     * @param changes changed values of other sensors
+     * @return names of sensors that were put into or released from quarantine
+     */
+    std::vector<std::string> feed(long long time_us, const Sensors & sensors, const Changes & changes);
+
+    /**
+     * @param name
+     * @return state of given sensor
+     */
+    State state(const std::string & name) const noexcept;
+
+    /**
+     * @return true iff any sensor is in quarantine
+     */
+    bool any() const noexcept;
+
+    /**
+     * @return number of times a sensor was put into quarantine
+     */
+    long quarantines() const noexcept;
+
+    /**
+     * @param now_us current monotonic time
+     * @return description of the sensors in quarantine, empty if there are none
+     */
+    std::string summary(long long now_us) const;
+
+    /**
+     * @param state
+     * @return name of given state
+     */
+    static const char * state_name(State state) noexcept;
+
+private:
+    /// History of a single sensor
+    struct Sensor {
+        State state = NORMAL;
+        /// Last value, always false for sensors that are not buttons
+        bool on = false;
+        /// Time of the last change of on
+        long long changed_us = 0;
+        /// Times of the changes within the last FLAP_WINDOW_MS
+        std::deque<long long> changes;
+        /// Time the sensor was put into quarantine
+        long long since_us = 0;
+        /// Time of the next check
+        long long recheck_us = 0;
+        /// Time between the last two checks
+        long long backoff_us = 0;
+    };
+
+    /// Sensors by name
+    std::map<std::string, Sensor> mSensors;
+
+    /// Number of sensors in quarantine
+    int mQuarantined = 0;
+
+    /// Number of times a sensor was put into quarantine
+    long mQuarantines = 0;
+
+    /**
+     * Record a change of given sensor
+     * @param sensor
+     * @param time_us
+     */
+    void changed(Sensor & sensor, long long time_us);
+
+    /**
+     * Put sensor into or release it from quarantine
+     * @param sensor
+     * @param time_us
+     * @return true iff the state has changed
+     */
+    bool check(Sensor & sensor, long long time_us);
+};
+
+#endif
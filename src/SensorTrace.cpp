@@ -0,0 +1,332 @@
+
+#include "SensorTrace.h"
+#include "InsaneException.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+
+
+namespace {
+
+/// Identifies trace files
+const char TRACE_MAGIC[] = "INSTRACE";
+
+/// Format version, increment on incompatible changes
+const unsigned long TRACE_VERSION = 2;
+
+/// Oldest version that can still be read, without value changes
+const unsigned long TRACE_VERSION_MIN = 1;
+
+
+void append_varint(std::string & out, unsigned long long value)
+{
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+
+unsigned long long parse_varint(const std::string & in, size_t & pos)
+{
+    unsigned long long value = 0;
+    for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+        unsigned char byte = static_cast<unsigned char>(in[pos++]);
+        value |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    throw InsaneException("Invalid number in sample message");
+}
+
+
+std::string parse_string(const std::string & in, size_t & pos)
+{
+    size_t size = parse_varint(in, pos);
+    if (size > in.size() - pos) {
+        throw InsaneException("Truncated sample message");
+    }
+    pos += size;
+    return in.substr(pos - size, size);
+}
+
+}
+
+
+SensorTrace::SensorTrace()
+{
+}
+
+
+SensorTrace::~SensorTrace() noexcept
+{
+    close();
+}
+
+
+void SensorTrace::open_write(const std::string & path, int period_ms)
+{
+    close();
+    mPath = path;
+    mFile = fopen(path.c_str(), "wb");
+    if (!mFile) {
+        throw InsaneException("Could not create trace file '" + path + "': " + strerror(errno));
+    }
+    fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC) - 1, mFile);
+    put_varint(TRACE_VERSION);
+    mPeriodMs = period_ms;
+    put_varint(static_cast<unsigned long long>(period_ms));
+    fflush(mFile);
+}
+
+
+void SensorTrace::open_read(const std::string & path)
+{
+    close();
+    mPath = path;
+    mFile = fopen(path.c_str(), "rb");
+    if (!mFile) {
+        throw InsaneException("Could not open trace file '" + path + "': " + strerror(errno));
+    }
+    struct stat st;
+    mFileSize = fstat(fileno(mFile), &st) == 0 ? static_cast<long long>(st.st_size) : 0;
+    char magic[sizeof(TRACE_MAGIC) - 1];
+    if (fread(magic, 1, sizeof(magic), mFile) != sizeof(magic) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+        close();
+        throw InsaneException("'" + path + "' is not an insaned trace file");
+    }
+    unsigned long long version = get_varint();
+    if (version < TRACE_VERSION_MIN || version > TRACE_VERSION) {
+        close();
+        throw InsaneException("Unsupported version " + std::to_string(version) + " of trace file '" + path + "'");
+    }
+    mVersion = version;
+    mPeriodMs = static_cast<int>(get_varint());
+}
+
+
+void SensorTrace::close() noexcept
+{
+    if (mFile) {
+        fclose(mFile);
+        mFile = nullptr;
+    }
+    mLastTimeUs = 0;
+    mNames.clear();
+    mIndices.clear();
+}
+
+
+bool SensorTrace::is_open() const noexcept
+{
+    return mFile != nullptr;
+}
+
+
+int SensorTrace::period_ms() const noexcept
+{
+    return mPeriodMs;
+}
+
+
+void SensorTrace::write(const SensorSample & sample)
+{
+    if (!mFile) {
+        return;
+    }
+    for (auto & sensor : sample.sensors) {
+        put_name(sensor.first);
+    }
+    for (auto & change : sample.changes) {
+        put_name(change.first);
+    }
+
+    fputc(RECORD_SAMPLE, mFile);
+    put_varint(static_cast<unsigned long long>(sample.time_us - mLastTimeUs));
+    mLastTimeUs = sample.time_us;
+    put_varint(static_cast<unsigned long long>(sample.status));
+    put_varint(sample.sensors.size());
+    for (auto & sensor : sample.sensors) {
+        put_varint((mIndices[sensor.first] << 1) | (sensor.second ? 1 : 0));
+    }
+    put_varint(sample.changes.size());
+    for (auto & change : sample.changes) {
+        put_varint(mIndices[change.first]);
+        put_varint(change.second.size());
+        fwrite(change.second.data(), 1, change.second.size(), mFile);
+    }
+    // keep the trace usable even if the daemon gets killed
+    if (fflush(mFile) != 0) {
+        throw InsaneException("Could not write trace file '" + mPath + "': " + strerror(errno));
+    }
+}
+
+
+bool SensorTrace::read(SensorSample & sample)
+{
+    if (!mFile) {
+        return false;
+    }
+    for (;;) {
+        int type = fgetc(mFile);
+        if (type == EOF) {
+            return false;
+        }
+        if (type == RECORD_NAME) {
+            std::string name(get_count(), '\0');
+            if (fread(&name[0], 1, name.size(), mFile) != name.size()) {
+                throw InsaneException("Truncated trace file '" + mPath + "'");
+            }
+            mNames.push_back(name);
+        } else if (type == RECORD_SAMPLE) {
+            mLastTimeUs += static_cast<long long>(get_varint());
+            sample.time_us = mLastTimeUs;
+            sample.status = static_cast<SANE_Status>(get_varint());
+            sample.sensors.resize(get_count());
+            for (auto & sensor : sample.sensors) {
+                unsigned long long value = get_varint();
+                if ((value >> 1) >= mNames.size()) {
+                    throw InsaneException("Invalid sensor index in trace file '" + mPath + "'");
+                }
+                sensor.first = mNames[value >> 1];
+                sensor.second = value & 1;
+            }
+            sample.changes.resize(mVersion >= 2 ? get_count() : 0);
+            for (auto & change : sample.changes) {
+                unsigned long long index = get_varint();
+                if (index >= mNames.size()) {
+                    throw InsaneException("Invalid sensor index in trace file '" + mPath + "'");
+                }
+                change.first = mNames[index];
+                change.second.resize(get_count());
+                if (fread(&change.second[0], 1, change.second.size(), mFile) != change.second.size()) {
+                    throw InsaneException("Truncated trace file '" + mPath + "'");
+                }
+            }
+            return true;
+        } else {
+            throw InsaneException("Invalid record type " + std::to_string(type) + " in trace file '" + mPath + "'");
+        }
+    }
+}
+
+
+void SensorTrace::put_varint(unsigned long long value)
+{
+    while (value >= 0x80) {
+        fputc(static_cast<int>((value & 0x7f) | 0x80), mFile);
+        value >>= 7;
+    }
+    fputc(static_cast<int>(value), mFile);
+}
+
+
+unsigned long SensorTrace::put_name(const std::string & name)
+{
+    auto it = mIndices.find(name);
+    if (it != mIndices.end()) {
+        return it->second;
+    }
+    unsigned long index = mIndices.size();
+    mIndices[name] = index;
+    fputc(RECORD_NAME, mFile);
+    put_varint(name.size());
+    fwrite(name.data(), 1, name.size(), mFile);
+    return index;
+}
+
+
+unsigned long long SensorTrace::get_varint()
+{
+    unsigned long long value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = get_byte();
+        value |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    throw InsaneException("Invalid number in trace file '" + mPath + "'");
+}
+
+
+size_t SensorTrace::get_count()
+{
+    unsigned long long count = get_varint();
+    // every item takes at least one byte, so a corrupt count cannot cause a huge allocation
+    long long pos = ftell(mFile);
+    if (pos < 0 || count > static_cast<unsigned long long>(std::max(mFileSize - pos, 0LL))) {
+        throw InsaneException("Invalid trace file '" + mPath + "'");
+    }
+    return static_cast<size_t>(count);
+}
+
+
+int SensorTrace::get_byte()
+{
+    int byte = fgetc(mFile);
+    if (byte == EOF) {
+        throw InsaneException("Truncated trace file '" + mPath + "'");
+    }
+    return byte;
+}
+
+
+std::string SensorTrace::encode(const SensorSample & sample)
+{
+    std::string out;
+    append_varint(out, static_cast<unsigned long long>(sample.time_us));
+    append_varint(out, static_cast<unsigned long long>(sample.status));
+    append_varint(out, sample.open_failed ? 1 : 0);
+    append_varint(out, sample.device.size());
+    out += sample.device;
+    append_varint(out, sample.sensors.size());
+    for (auto & sensor : sample.sensors) {
+        append_varint(out, sensor.first.size());
+        out += sensor.first;
+        out += static_cast<char>(sensor.second ? 1 : 0);
+    }
+    append_varint(out, sample.changes.size());
+    for (auto & change : sample.changes) {
+        append_varint(out, change.first.size());
+        out += change.first;
+        append_varint(out, change.second.size());
+        out += change.second;
+    }
+    return out;
+}
+
+
+void SensorTrace::decode(const std::string & message, SensorSample & sample)
+{
+    size_t pos = 0;
+    sample.time_us = static_cast<long long>(parse_varint(message, pos));
+    sample.status = static_cast<SANE_Status>(parse_varint(message, pos));
+    sample.open_failed = parse_varint(message, pos) != 0;
+    sample.device = parse_string(message, pos);
+    size_t count = parse_varint(message, pos);
+    if (count > message.size() - pos) {
+        throw InsaneException("Truncated sample message");
+    }
+    sample.sensors.resize(count);
+    for (auto & sensor : sample.sensors) {
+        sensor.first = parse_string(message, pos);
+        if (pos >= message.size()) {
+            throw InsaneException("Truncated sample message");
+        }
+        sensor.second = message[pos++] != 0;
+    }
+    count = parse_varint(message, pos);
+    if (count > message.size() - pos) {
+        throw InsaneException("Truncated sample message");
+    }
+    sample.changes.resize(count);
+    for (auto & change : sample.changes) {
+        change.first = parse_string(message, pos);
+        change.second = parse_string(message, pos);
+    }
+}
@@ -0,0 +1,190 @@
+/*
+ *  SensorTrace.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+#ifndef SENSORTRACE_H
+#define SENSORTRACE_H
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sane/sane.h>
+
+
+/** Result of a single poll of all sensors
+ */
+struct SensorSample
+{
+    /// Monotonic time of the poll in us
+    long long time_us = 0;
+
+    /// Status of the poll, sensors are empty unless it is SANE_STATUS_GOOD
+    SANE_Status status = SANE_STATUS_GOOD;
+
+    /// Button states
+    typedef std::vector<std::pair<std::string, bool>> Sensors;
+
+    /// Changed sensor values
+    typedef std::vector<std::pair<std::string, std::string>> Changes;
+
+    /// Button names and values
+    Sensors sensors;
+
+    /// Int, fixed and string sensors whose value changed since the previous poll, with their new value
+    Changes changes;
+
+    /// Device the sensors were read from
+    std::string device;
+
+    /// True iff the poll failed because the device could not be opened
+    bool open_failed = false;
+};
+
+
+/** Compact binary recording of sensor samples.
+ *
+ * The file starts with a magic string and a version, followed by a stream of
+ * records. Sensor names are written once and referenced by index afterwards,
+ * all numbers are stored as unsigned LEB128 varints, so a typical sample
+ * takes less than 10 bytes.
+ */
+class SensorTrace
+{
+public:
+    /** Constructor
+     */
+    SensorTrace();
+
+    /** Destructor, closes the trace file
+     */
+    ~SensorTrace() noexcept;
+
+    /**
+     * Create given trace file for writing, truncating it.
+     * @param path
+     * @param period_ms polling period the samples are taken with
+     */
+    void open_write(const std::string & path, int period_ms);
+
+    /**
+     * Open given trace file for reading.
+     * @param path
+     */
+    void open_read(const std::string & path);
+
+    /**
+     * Close trace file, if any
+     */
+    void close() noexcept;
+
+    /**
+     * @return true iff a trace file is opened
+     */
+    bool is_open() const noexcept;
+
+    /**
+     * @return polling period the samples were recorded with
+     */
+    int period_ms() const noexcept;
+
+    /**
+     * Append given sample to the trace
+     * @param sample
+     */
+    void write(const SensorSample & sample);
+
+    /**
+     * Read next sample from the trace
+     * @param sample
+     * @return false on end of file
+     */
+    bool read(SensorSample & sample);
+
+    /**
+     * Serialize given sample into a self-contained message, e.g. to send it to another process
+     * @param sample
+     * @return message
+     */
+    static std::string encode(const SensorSample & sample);
+
+    /**
+     * Deserialize a message created by encode()
+     * @param message
+     * @param sample
+     */
+    static void decode(const std::string & message, SensorSample & sample);
+
+private:
+    /// Record types
+    enum Record : int {
+        RECORD_NAME = 'N',
+        RECORD_SAMPLE = 'S'
+    };
+
+    /// Trace file
+    FILE * mFile = nullptr;
+
+    /// Trace file name, for error messages
+    std::string mPath;
+
+    /// Polling period in ms
+    int mPeriodMs = 0;
+
+    /// Format version of the file being read
+    unsigned long long mVersion = 0;
+
+    /// Size of the file being read
+    long long mFileSize = 0;
+
+    /// Time of the previous sample, sample times are stored as deltas
+    long long mLastTimeUs = 0;
+
+    /// Sensor names by index (reading)
+    std::vector<std::string> mNames;
+
+    /// Sensor indices by name (writing)
+    std::map<std::string, unsigned long> mIndices;
+
+    // Forbid copy
+    SensorTrace(const SensorTrace &);
+    SensorTrace & operator=(const SensorTrace &);
+
+    void put_varint(unsigned long long value);
+
+    /**
+     * Write a name record for the given sensor name, unless it was already written
+     * @return index of the name
+     */
+    unsigned long put_name(const std::string & name);
+
+    unsigned long long get_varint();
+
+    /**
+     * Read a number of items or bytes that follow in the file
+     * @return the number, which is not larger than the rest of the file
+     */
+    size_t get_count();
+
+    int get_byte();
+};
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ *  SpscRing.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+
+/** Bounded wait-free queue for exactly one producer and one consumer thread.
+ *
+ * The producer only writes mTail and the consumer only writes mHead, so
+ * neither side ever waits for the other: push() fails if the ring is full
+ * and pop() fails if it is empty.
+ *
+ * @tparam T element type, must be default constructible and movable
+ * @tparam N capacity, must be a power of 2
+ */
+template <typename T, size_t N>
+class SpscRing
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of 2");
+
+public:
+    /**
+     * Append an element, called by the producer only
+     * @param value
+     * @return false if the ring is full
+     */
+    bool push(T && value) noexcept
+    {
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail - mHead.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        mItems[tail & (N - 1)] = std::move(value);
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Remove the oldest element, called by the consumer only
+     * @param value set to the element
+     * @return false if the ring is empty
+     */
+    bool pop(T & value) noexcept
+    {
+        size_t head = mHead.load(std::memory_order_relaxed);
+        if (head == mTail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = std::move(mItems[head & (N - 1)]);
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @return number of queued elements, exact only when called by the producer or consumer
+     */
+    size_t size() const noexcept
+    {
+        return mTail.load(std::memory_order_acquire) - mHead.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @return capacity
+     */
+    static constexpr size_t capacity() noexcept
+    {
+        return N;
+    }
+
+private:
+    /// Next element to pop, written by the consumer
+    alignas(64) std::atomic<size_t> mHead{0};
+
+    /// Next free slot, written by the producer
+    alignas(64) std::atomic<size_t> mTail{0};
+
+    /// Elements
+    alignas(64) T mItems[N];
+};
+
+#endif
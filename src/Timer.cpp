@@ -1,6 +1,8 @@
 
 #include "Timer.h"
 
+#include <time.h>
+
 
 Timer::Timer()
 {
@@ -9,8 +11,22 @@ Timer::Timer()
 
 
 long Timer::restart()
+{
+    return static_cast<long>(restart_us() / 1000);
+}
+
+
+long long Timer::restart_us()
 {
     timeval old = mTime;
     gettimeofday(&mTime, nullptr);
-    return (mTime.tv_sec - old.tv_sec) * 1000 + (mTime.tv_usec - old.tv_usec) / 1000;
+    return static_cast<long long>(mTime.tv_sec - old.tv_sec) * 1000000 + (mTime.tv_usec - old.tv_usec);
+}
+
+
+long long Timer::monotonic_us()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<long long>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
 }
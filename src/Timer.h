@@ -41,6 +41,17 @@ public:
      */
     long restart();
 
+    /**
+     * Restart timing
+     * @return time in us, elapsed since last call to restart() or construction
+     */
+    long long restart_us();
+
+    /**
+     * @return current time of the monotonic clock in us
+     */
+    static long long monotonic_us();
+
 private:
     timeval mTime;
 };
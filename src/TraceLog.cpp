@@ -0,0 +1,133 @@
+
+#include "TraceLog.h"
+#include "InsaneException.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "Timer.h"
+
+
+namespace {
+
+/**
+ * @return string with JSON special characters escaped
+ */
+std::string json_escape(const std::string & text)
+{
+    std::string result;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            result += buf;
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+
+/**
+ * @return id of the calling thread
+ */
+long thread_id() noexcept
+{
+#ifdef __linux__
+    return static_cast<long>(syscall(SYS_gettid));
+#else
+    return static_cast<long>(getpid());
+#endif
+}
+
+}
+
+
+int TraceLog::mFd = -1;
+
+
+void TraceLog::open(const std::string & path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        throw InsaneException("Could not create trace file '" + path + "': " + strerror(errno));
+    }
+    // event handler scripts should not inherit it
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    // the closing bracket is optional, so the file stays valid if the daemon is killed
+    if (::write(fd, "[\n", 2) != 2) {
+        ::close(fd);
+        throw InsaneException("Could not write trace file '" + path + "': " + strerror(errno));
+    }
+    mFd = fd;
+}
+
+
+void TraceLog::close() noexcept
+{
+    if (mFd >= 0) {
+        ::close(mFd);
+        mFd = -1;
+    }
+}
+
+
+void TraceLog::begin(const char * name, const std::string & detail) noexcept
+{
+    write('B', name, detail);
+}
+
+
+void TraceLog::end(const char * name, const std::string & detail) noexcept
+{
+    write('E', name, detail);
+}
+
+
+void TraceLog::instant(const char * name, const std::string & detail) noexcept
+{
+    write('i', name, detail);
+}
+
+
+void TraceLog::async_begin(const char * name, long id, const std::string & detail) noexcept
+{
+    write('b', name, detail, id);
+}
+
+
+void TraceLog::async_end(const char * name, long id, const std::string & detail) noexcept
+{
+    write('e', name, detail, id);
+}
+
+
+void TraceLog::write(char phase, const char * name, const std::string & detail, long id) noexcept
+{
+    try {
+        std::string event = std::string("{\"name\":\"") + name + "\",\"cat\":\"insaned\",\"ph\":\"" + phase + "\""
+            + (phase == 'i' ? ",\"s\":\"t\"" : "")
+            + (id >= 0 ? ",\"id\":" + std::to_string(id) : "")
+            + ",\"ts\":" + std::to_string(Timer::monotonic_us())
+            + ",\"pid\":" + std::to_string(getpid())
+            + ",\"tid\":" + std::to_string(thread_id())
+            + ",\"args\":{\"detail\":\"" + json_escape(detail) + "\"}},\n";
+        if (::write(mFd, event.data(), event.size()) < 0) {
+            // tracing must never disturb the daemon
+            close();
+        }
+    } catch (...) {
+        close();
+    }
+}
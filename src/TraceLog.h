@@ -0,0 +1,133 @@
+/*
+ *  TraceLog.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+#ifndef TRACELOG_H
+#define TRACELOG_H
+
+#include <string>
+
+
+/*
+ * Static tracepoints for bpftrace, perf, systemtap etc., e.g.
+ *   bpftrace -e 'usdt:./insaned:insaned:poll_end { printf("%d\n", arg0); }'
+ * They compile to a single nop if sys/sdt.h is available, and to nothing otherwise.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define INSANE_PROBE(name) DTRACE_PROBE(insaned, name)
+#define INSANE_PROBE1(name, a) DTRACE_PROBE1(insaned, name, a)
+#define INSANE_PROBE2(name, a, b) DTRACE_PROBE2(insaned, name, a, b)
+#else
+#define INSANE_PROBE(name) do {} while (0)
+#define INSANE_PROBE1(name, a) do {} while (0)
+#define INSANE_PROBE2(name, a, b) do {} while (0)
+#endif
+
+/*
+ * Events for the Chrome trace file. Arguments are only evaluated if a trace file is open.
+ */
+#define INSANE_TRACE_BEGIN(name, detail) do { if (TraceLog::enabled()) { TraceLog::begin(name, detail); } } while (0)
+#define INSANE_TRACE_END(name, detail) do { if (TraceLog::enabled()) { TraceLog::end(name, detail); } } while (0)
+#define INSANE_TRACE_INSTANT(name, detail) do { if (TraceLog::enabled()) { TraceLog::instant(name, detail); } } while (0)
+#define INSANE_TRACE_ASYNC_BEGIN(name, id, detail) do { if (TraceLog::enabled()) { TraceLog::async_begin(name, id, detail); } } while (0)
+#define INSANE_TRACE_ASYNC_END(name, id, detail) do { if (TraceLog::enabled()) { TraceLog::async_end(name, id, detail); } } while (0)
+
+
+/** Writer of Chrome trace event files (JSON array format).
+ *
+ * Every event is appended with a single write(), so several processes can
+ * share the file, e.g. the daemon and its poller process. The resulting file
+ * can be opened in chrome://tracing or https://ui.perfetto.dev
+ */
+class TraceLog
+{
+public:
+    /**
+     * Start writing trace events to the given file, truncating it
+     * @param path
+     */
+    static void open(const std::string & path);
+
+    /**
+     * Stop writing trace events
+     */
+    static void close() noexcept;
+
+    /**
+     * @return true iff a trace file is open
+     */
+    static bool enabled() noexcept {
+        return mFd >= 0;
+    }
+
+    /**
+     * Begin a duration event
+     * @param name
+     * @param detail shown as argument of the event
+     */
+    static void begin(const char * name, const std::string & detail) noexcept;
+
+    /**
+     * End a duration event started with begin()
+     * @param name
+     * @param detail shown as argument of the event
+     */
+    static void end(const char * name, const std::string & detail) noexcept;
+
+    /**
+     * Write an instant event
+     * @param name
+     * @param detail shown as argument of the event
+     */
+    static void instant(const char * name, const std::string & detail) noexcept;
+
+    /**
+     * Begin an asynchronous event, which may overlap other events of the same thread,
+     * e.g. event handlers running in parallel
+     * @param name
+     * @param id identifies the event, e.g. a pid
+     * @param detail shown as argument of the event
+     */
+    static void async_begin(const char * name, long id, const std::string & detail) noexcept;
+
+    /**
+     * End an asynchronous event started with async_begin()
+     * @param name
+     * @param id
+     * @param detail shown as argument of the event
+     */
+    static void async_end(const char * name, long id, const std::string & detail) noexcept;
+
+private:
+    /// Trace file descriptor, -1 if disabled
+    static int mFd;
+
+    /**
+     * Append a single event
+     * @param phase Chrome trace event type
+     * @param name
+     * @param detail
+     * @param id of asynchronous events, -1 for other events
+     */
+    static void write(char phase, const char * name, const std::string & detail, long id = -1) noexcept;
+};
+
+#endif
@@ -0,0 +1,99 @@
+
+#include "UsbPower.h"
+#include "config.h"
+
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+
+
+UsbPower::UsbPower()
+{
+}
+
+
+bool UsbPower::find(const std::string & device)
+{
+    mPath.clear();
+    // libusb device names end with bus and device number
+    size_t pos = device.find("libusb:");
+    if (pos == std::string::npos) {
+        return false;
+    }
+    std::string address = device.substr(pos + 7);
+    size_t colon = address.find(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    long bus = strtol(address.substr(0, colon).c_str(), nullptr, 10);
+    long dev = strtol(address.substr(colon + 1).c_str(), nullptr, 10);
+
+    DIR * dir = opendir(USB_SYSFS_DIR);
+    if (!dir) {
+        return false;
+    }
+    while (dirent * entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        mPath = std::string(USB_SYSFS_DIR) + "/" + entry->d_name;
+        std::string busnum = read("busnum");
+        std::string devnum = read("devnum");
+        if (!busnum.empty() && !devnum.empty() && atol(busnum.c_str()) == bus && atol(devnum.c_str()) == dev) {
+            closedir(dir);
+            return true;
+        }
+    }
+    closedir(dir);
+    mPath.clear();
+    return false;
+}
+
+
+std::string UsbPower::path() const
+{
+    return mPath;
+}
+
+
+long UsbPower::autosuspend_delay_ms() const
+{
+    std::string delay = read("power/autosuspend_delay_ms");
+    if (delay.empty()) {
+        return -1;
+    }
+    // negative values disable autosuspend
+    long ms = atol(delay.c_str());
+    return ms < 0 ? -1 : ms;
+}
+
+
+std::string UsbPower::control() const
+{
+    return read("power/control");
+}
+
+
+std::string UsbPower::runtime_status() const
+{
+    return read("power/runtime_status");
+}
+
+
+long long UsbPower::suspended_time_ms() const
+{
+    std::string time = read("power/runtime_suspended_time");
+    return time.empty() ? -1 : atoll(time.c_str());
+}
+
+
+std::string UsbPower::read(const std::string & name) const
+{
+    if (mPath.empty()) {
+        return "";
+    }
+    std::ifstream in(mPath + "/" + name);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
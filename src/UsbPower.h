@@ -0,0 +1,85 @@
+/*
+ *  UsbPower.h
+ *
+ *  This file is part of insaned.
+ *  insaned is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  insaned is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with insaned; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Copyright (C) 2013-2014 Alex Busenius <the_unknown@gmx.net>
+ */
+
+
+#ifndef USBPOWER_H
+#define USBPOWER_H
+
+#include <string>
+
+
+/** Runtime power management state of a USB scanner in sysfs.
+ *
+ * The kernel suspends an idle USB device after its autosuspend delay, if
+ * power/control is "auto". Every poll wakes the device up again, so it
+ * can only sleep if the pause between polls is longer than that delay.
+ */
+class UsbPower
+{
+public:
+    /** Constructor
+     */
+    UsbPower();
+
+    /**
+     * Find the sysfs directory of a device from its SANE name (e.g. genesys:libusb:001:003)
+     * @param device
+     * @return false if the device is not a USB device or was not found
+     */
+    bool find(const std::string & device);
+
+    /**
+     * @return sysfs directory of the device, or empty string if not found
+     */
+    std::string path() const;
+
+    /**
+     * @return autosuspend delay in ms, or -1 if autosuspend is not available
+     */
+    long autosuspend_delay_ms() const;
+
+    /**
+     * @return content of power/control, "auto" if the device may be suspended
+     */
+    std::string control() const;
+
+    /**
+     * @return content of power/runtime_status, e.g. "active" or "suspended"
+     */
+    std::string runtime_status() const;
+
+    /**
+     * @return total time the device was suspended in ms, or -1 if unknown
+     */
+    long long suspended_time_ms() const;
+
+private:
+    /// Sysfs directory of the device
+    std::string mPath;
+
+    /**
+     * @param name file relative to mPath
+     * @return first line of the file, or empty string
+     */
+    std::string read(const std::string & name) const;
+};
+
+#endif
@@ -5,3 +5,26 @@
 /* Define to the version of the distribution. */
 #define VERSION "0.0.3"
 
+
+/* Directories to search for SANE backends in, when loading them directly. */
+#ifndef SANE_BACKEND_DIRS
+#define SANE_BACKEND_DIRS "/usr/lib/sane:/usr/lib64/sane:/usr/local/lib/sane:/usr/local/lib64/sane"
+#endif
+
+/* File remembering the last device found, used until the device list is available at startup. */
+#ifndef DEVICE_CACHE_FILE
+#define DEVICE_CACHE_FILE "/var/cache/insaned.device"
+#endif
+
+/* Directory with USB devices in sysfs, used to find the power state of the scanner. */
+#ifndef USB_SYSFS_DIR
+#define USB_SYSFS_DIR "/sys/bus/usb/devices"
+#endif
+
+/* Capacity of the button and debounce tables in the lean build (make lean). */
+#ifndef INSANE_MAX_SENSORS
+#define INSANE_MAX_SENSORS 32
+#endif
+#ifndef INSANE_MAX_EVENTS
+#define INSANE_MAX_EVENTS 64
+#endif
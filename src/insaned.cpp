@@ -26,6 +26,7 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 #include <getopt.h>
 #include <syslog.h>
 #include <unistd.h>
@@ -39,6 +40,7 @@
 #include <cstring>
 #include <cstdio>
 
+#include "EventJournal.h"
 #include "InsaneDaemon.h"
 #include "InsaneException.h"
 
@@ -56,6 +58,24 @@ std::string basename(const std::string & path)
 }
 
 
+std::vector<std::string> split(const std::string & text, char separator)
+{
+    std::vector<std::string> result;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(separator, start);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        if (end > start) {
+            result.push_back(text.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return result;
+}
+
+
 bool createIfNeeded(const std::string & path, bool isFile)
 {
     struct stat sb;
@@ -110,13 +130,39 @@ int main(int argc, char ** argv)
     // defaults
     const std::string LOGFILE       = "/var/log/" + InsaneDaemon::NAME + ".log";
     const std::string EVENTS_DIR    = "/etc/" + InsaneDaemon::NAME + "/events";
+    const std::string JOURNAL_FILE  = "/var/log/" + InsaneDaemon::NAME + ".journal";
     const int SLEEP_MS              = 500;
     const int SLEEP_MIN             = 50;
     const int SLEEP_MAX             = 5000;
+    const int POLL_DEADLINE_MS      = 10000;
+    const int BENCHMARK_POLLS       = 100;
+    const std::string GESTURE_MS    = "1000,400,150";
     const int VERBOSITY             = 0;
     const bool DO_FORK              = true;
     const bool SUSPEND_AFTER_EVENT  = false;
 
+    // command line options without short form
+    enum {
+        OPT_RECORD = 256,
+        OPT_REPLAY,
+        OPT_DIRECT_BACKEND,
+        OPT_ISOLATE_POLLER,
+        OPT_POLL_DEADLINE_MS,
+        OPT_TRACE_FILE,
+        OPT_PAUSE_WHILE,
+        OPT_JOURNAL,
+        OPT_JOURNAL_FILE,
+        OPT_GESTURES,
+        OPT_THREADS,
+        OPT_EVENT_SOCKET,
+        OPT_SANE_PROXY,
+        OPT_POWER_SAVE,
+        OPT_BENCHMARK,
+        OPT_CONFIG,
+        OPT_HANDLER_CLASS,
+        OPT_POLL_DURING_HANDLERS
+    };
+
     // command line options
     const char * BASE_OPTSTRING = "d:hvVf:e:s:nLwp:";
     option basic_options[] = {
@@ -131,6 +177,24 @@ int main(int argc, char ** argv)
         {"list-sensors", no_argument, nullptr, 'L'},
         {"suspend-after-event", no_argument, nullptr, 'w'},
         {"pid-file", required_argument, nullptr, 'p'},
+        {"record", required_argument, nullptr, OPT_RECORD},
+        {"replay", required_argument, nullptr, OPT_REPLAY},
+        {"direct-backend", no_argument, nullptr, OPT_DIRECT_BACKEND},
+        {"isolate-poller", no_argument, nullptr, OPT_ISOLATE_POLLER},
+        {"poll-deadline-ms", required_argument, nullptr, OPT_POLL_DEADLINE_MS},
+        {"trace-file", required_argument, nullptr, OPT_TRACE_FILE},
+        {"pause-while", required_argument, nullptr, OPT_PAUSE_WHILE},
+        {"journal", no_argument, nullptr, OPT_JOURNAL},
+        {"journal-file", required_argument, nullptr, OPT_JOURNAL_FILE},
+        {"gestures", optional_argument, nullptr, OPT_GESTURES},
+        {"threads", no_argument, nullptr, OPT_THREADS},
+        {"event-socket", required_argument, nullptr, OPT_EVENT_SOCKET},
+        {"sane-proxy", optional_argument, nullptr, OPT_SANE_PROXY},
+        {"power-save", optional_argument, nullptr, OPT_POWER_SAVE},
+        {"benchmark", optional_argument, nullptr, OPT_BENCHMARK},
+        {"config", required_argument, nullptr, OPT_CONFIG},
+        {"handler-class", required_argument, nullptr, OPT_HANDLER_CLASS},
+        {"poll-during-handlers", no_argument, nullptr, OPT_POLL_DURING_HANDLERS},
         {0, 0, nullptr, 0}
     };
 
@@ -144,6 +208,9 @@ int main(int argc, char ** argv)
     bool help = false;
     bool list = false;
     bool suspend = SUSPEND_AFTER_EVENT;
+    bool direct_backend = false;
+    bool isolate_poller = false;
+    int poll_deadline_ms = POLL_DEADLINE_MS;
     int verbose = VERBOSITY;
     bool do_fork = DO_FORK;
     int sleep_ms = SLEEP_MS;
@@ -151,6 +218,21 @@ int main(int argc, char ** argv)
     std::string pidfile = "";
     std::string logfile = LOGFILE;
     std::string events_dir = EVENTS_DIR;
+    std::string record_file = "";
+    std::string replay_file = "";
+    std::string trace_file = "";
+    std::vector<std::string> pause_while;
+    bool print_journal = false;
+    std::vector<int> gesture_ms;
+    bool threads = false;
+    bool poll_during_handlers = false;
+    std::string event_socket = "";
+    int sane_proxy_port = 0;
+    int power_save_ms = -1;
+    int benchmark_polls = 0;
+    std::string journal_file = "";
+    std::string config_file = "";
+    std::string handler_class = "";
 
     // get dameon instance
     InsaneDaemon & daemon = InsaneDaemon::instance();
@@ -207,6 +289,108 @@ int main(int argc, char ** argv)
         case 'w':
             suspend = true;
             break;
+        case OPT_RECORD:
+            record_file = optarg;
+            break;
+        case OPT_REPLAY:
+            replay_file = optarg;
+            break;
+        case OPT_DIRECT_BACKEND:
+            direct_backend = true;
+            break;
+        case OPT_JOURNAL:
+            print_journal = true;
+            break;
+        case OPT_JOURNAL_FILE:
+            journal_file = optarg;
+            break;
+        case OPT_POWER_SAVE:
+            try {
+                power_save_ms = optarg ? std::stoi(std::string(optarg)) : 0;
+                if (power_save_ms < 0) {
+                    throw std::out_of_range("The value must not be negative");
+                }
+            } catch (std::exception & e) {
+                std::cerr << "Invalid value of --power-save (" << optarg << "): " << e.what() << std::endl;
+                return 1;
+            }
+            break;
+        case OPT_BENCHMARK:
+            try {
+                benchmark_polls = optarg ? std::stoi(std::string(optarg)) : BENCHMARK_POLLS;
+                if (benchmark_polls < 1) {
+                    throw std::out_of_range("The value must be positive");
+                }
+            } catch (std::exception & e) {
+                std::cerr << "Invalid value of --benchmark (" << optarg << "): " << e.what() << std::endl;
+                return 1;
+            }
+            break;
+        case OPT_SANE_PROXY:
+            try {
+                sane_proxy_port = optarg ? std::stoi(std::string(optarg)) : SaneProxy::DEFAULT_PORT;
+                if (sane_proxy_port <= 0 || 65535 < sane_proxy_port) {
+                    throw std::out_of_range("The value must be in range 1..65535");
+                }
+            } catch (std::exception & e) {
+                std::cerr << "Invalid value of --sane-proxy (" << optarg << "): " << e.what() << std::endl;
+                return 1;
+            }
+            break;
+        case OPT_HANDLER_CLASS:
+            handler_class = optarg;
+            break;
+        case OPT_CONFIG:
+            config_file = optarg;
+            break;
+        case OPT_EVENT_SOCKET:
+            event_socket = optarg;
+            break;
+        case OPT_THREADS:
+            threads = true;
+            break;
+        case OPT_POLL_DURING_HANDLERS:
+            poll_during_handlers = true;
+            break;
+        case OPT_GESTURES:
+            try {
+                gesture_ms.clear();
+                for (auto & ms : split(optarg ? optarg : GESTURE_MS, ',')) {
+                    gesture_ms.push_back(std::stoi(ms));
+                    if (gesture_ms.back() < 0) {
+                        throw std::out_of_range("The values must not be negative");
+                    }
+                }
+                if (gesture_ms.size() != 3) {
+                    throw std::invalid_argument("Expected three values");
+                }
+            } catch (std::exception & e) {
+                std::cerr << "Invalid value of --gestures (" << (optarg ? optarg : GESTURE_MS) << "): " << e.what() << std::endl;
+                return 1;
+            }
+            break;
+        case OPT_PAUSE_WHILE:
+            for (auto & name : split(optarg, ',')) {
+                pause_while.push_back(name);
+            }
+            break;
+        case OPT_TRACE_FILE:
+            trace_file = optarg;
+            break;
+        case OPT_ISOLATE_POLLER:
+            isolate_poller = true;
+            break;
+        case OPT_POLL_DEADLINE_MS:
+            try {
+                poll_deadline_ms = std::stoi(std::string(optarg));
+                if (poll_deadline_ms <= 0) {
+                    throw std::out_of_range("The value must be positive");
+                }
+            } catch (std::exception & e) {
+                std::cerr << "Invalid value of --poll-deadline-ms (" << optarg << "): " << e.what() << std::endl;
+                return 1;
+            }
+            break;
         default:
             std::cerr << "Unknown option: " << static_cast<char>(ch) << std::endl;
             return 1;
@@ -215,7 +399,10 @@ int main(int argc, char ** argv)
     }
 
     try {
-        daemon.init(devname, events_dir, sleep_ms, verbose, do_fork && !(help || list), suspend);
+        daemon.init(devname, events_dir, sleep_ms, verbose, do_fork && !(help || list || print_journal || benchmark_polls > 0 || !replay_file.empty()), suspend);
+        if (direct_backend) {
+            daemon.load_backend();
+        }
 
         /* print help and device list */
         if (help) {
@@ -239,10 +426,68 @@ int main(int argc, char ** argv)
                 << " -L, --list-sensors         list sensors that will be monitored along with their\n"
                 << "                            current state and exit. See also --device-name\n"
                 << " -w, --suspend-after-event  suspend sensor polling for 15 seconds after an event\n"
-                << "                            handler script was triggered. Use this if insaned\n"
-                << "                            tends to interfere with your handlers.\n"
+                << "                            handler script finished. Use this if insaned tends\n"
+                << "                            to interfere with your handlers.\n"
                 << " -p, --pid-file=FILE        if this option is present, the daemon will create\n"
                 << "                            this file and write its PID into it after fork\n"
+                << "     --record=FILE          record a compact binary trace of every poll result\n"
+                << "                            into the given file\n"
+                << "     --replay=FILE          feed a trace recorded with --record through event\n"
+                << "                            processing as fast as possible without running any\n"
+                << "                            handler scripts, report dispatch decisions and exit\n"
+                << "     --direct-backend       load only the backend of the device given with\n"
+                << "                            --device-name (e.g. genesys:libusb:001:003) instead\n"
+                << "                            of all backends configured in dll.conf\n"
+                << "     --trace-file=FILE      write timings of polls, SANE calls, events and\n"
+                << "                            handlers into the given file as Chrome trace events\n"
+                << "     --isolate-poller       poll the sensors in a separate process, so that a\n"
+                << "                            hanging or crashing SANE backend cannot block or\n"
+                << "                            kill the daemon\n"
+                << "     --threads              read the sensors in a separate thread, so that event\n"
+                << "                            processing does not delay the next poll\n"
+                << "     --poll-during-handlers\n"
+                << "                            keep polling while an event handler script runs.\n"
+                << "                            Only use this if handlers do not open the device\n"
+                << "                            themselves (e.g. they scan through --sane-proxy)\n"
+                << "     --poll-deadline-ms=NUMBER\n"
+                << "                            restart the poller process if a single poll takes\n"
+                << "                            longer than the given amount of ms (default: " << POLL_DEADLINE_MS << ")\n"
+                << "     --journal-file=FILE    append dispatched events and exit status of their\n"
+                << "                            handlers to the given journal file\n"
+                << "     --journal              print the journal (given by --journal-file, default:\n"
+                << "                            " << JOURNAL_FILE << ") and exit\n"
+                << "     --gestures[=LONG,DOUBLE,CHORD]\n"
+                << "                            dispatch gestures instead of single presses, e.g.\n"
+                << "                            scan.long when held for LONG ms, scan.double when\n"
+                << "                            pressed twice within DOUBLE ms and copy+scan when\n"
+                << "                            pressed within CHORD ms (default: " << GESTURE_MS << ")\n"
+                << "     --event-socket=PATH    push dispatched events to clients connected to a Unix\n"
+                << "                            domain socket at the given path\n"
+                << "     --sane-proxy[=PORT]    let event handler scripts scan with the device through\n"
+                << "                            the SANE net backend (net:localhost:DEVICE) on the\n"
+                << "                            given port of localhost (default: " << SaneProxy::DEFAULT_PORT << ")\n"
+                << "     --power-save[=MS]      poll in short bursts separated by pauses of the given\n"
+                << "                            length (default: twice the USB autosuspend delay),\n"
+                << "                            so that the scanner can be suspended in between\n"
+                << "     --benchmark[=POLLS]    poll the device the given number of times (default: "
+                << BENCHMARK_POLLS << ")\n"
+                << "                            with different strategies, report how long each\n"
+                << "                            SANE call takes and the minimum safe --sleep-ms\n"
+                << "     --handler-class=\"NAME=VALUE...\"\n"
+                << "                            run event handler scripts with the given nice=-20..19,\n"
+                << "                            ioprio=idle|best-effort[:0-7]|realtime[:0-7],\n"
+                << "                            cpus=LIST and cgroup=DIR with cpu-max=PERCENT and\n"
+                << "                            memory-max=BYTES[K|M|G], e.g. \"nice=10 ioprio=idle\"\n"
+                << "     --config=FILE          read events-dir, sleep-ms, suspend-after-event,\n"
+                << "                            poll-during-handlers, verbose, gestures,\n"
+                << "                            pause-while, ignore (sensors without events),\n"
+                << "                            handler-class and handler-class.EVENT as\n"
+                << "                            key = value lines from the given file, overriding\n"
+                << "                            the command line. Send SIGHUP to apply changes\n"
+                << "                            without restarting\n"
+                << "     --pause-while=NAME[,NAME...]\n"
+                << "                            do not poll the sensors while any process with one\n"
+                << "                            of the given names (e.g. xsane) is running\n"
                 << " -v, --verbose              give even more status messages\n"
                 << " -h, --help                 display this help message and exit\n"
                 << " -V, --version              print version information and exit" << std::endl;
@@ -258,13 +503,75 @@ int main(int argc, char ** argv)
         }
 
         if (list) {
-            auto sensors = daemon.get_sensors(); // updates current device if it was not set
+            std::vector<std::pair<std::string, std::string>> values;
+            auto sensors = daemon.get_sensors(&values); // updates current device if it was not set
             std::cout << "List of sensors for device '" << daemon.current_device() << "':" << std::endl;
             for (auto & pair : sensors) {
                 std::cout << "    " << pair.first << "\t" << (pair.second ? "[yes]" : "[no]") << std::endl;
             }
+            for (auto & pair : values) {
+                std::cout << "    " << pair.first << "\t" << pair.second << std::endl;
+            }
+            return 0;
+        }
+
+        if (!gesture_ms.empty()) {
+            daemon.gestures(gesture_ms[0], gesture_ms[1], gesture_ms[2]);
+        }
+
+        if (!replay_file.empty()) {
+            daemon.replay(replay_file, std::cout);
+            return 0;
+        }
+
+        if (benchmark_polls > 0) {
+            daemon.benchmark(benchmark_polls, std::cout);
+            return 0;
+        }
+
+        if (print_journal) {
+            EventJournal journal;
+            journal.open(journal_file.empty() ? JOURNAL_FILE : journal_file, false);
+            journal.print(std::cout);
             return 0;
         }
+
+        if (!record_file.empty()) {
+            daemon.record(record_file);
+        }
+        if (!trace_file.empty()) {
+            daemon.trace(trace_file);
+        }
+        if (isolate_poller) {
+            daemon.isolate_poller(poll_deadline_ms);
+        }
+        if (threads) {
+            daemon.threads();
+        }
+        if (poll_during_handlers) {
+            daemon.poll_during_handlers();
+        }
+        if (!event_socket.empty()) {
+            daemon.serve_events(event_socket);
+        }
+        if (sane_proxy_port > 0) {
+            daemon.serve_sane(sane_proxy_port);
+        }
+        if (power_save_ms >= 0) {
+            daemon.power_save(power_save_ms);
+        }
+        if (!pause_while.empty()) {
+            daemon.pause_while(pause_while);
+        }
+        if (!journal_file.empty()) {
+            daemon.journal(journal_file);
+        }
+        if (!handler_class.empty()) {
+            daemon.handler_class(handler_class);
+        }
+        if (!config_file.empty()) {
+            daemon.config(config_file);
+        }
     } catch (InsaneException & e) {
         std::cerr << InsaneDaemon::NAME << ": " << e.what() << std::endl;
         return 1;